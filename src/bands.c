@@ -0,0 +1,68 @@
+#include "bands.h"
+
+typedef struct {
+  GMutex mutex;
+  GCond cond;
+  int remaining;
+} band_sync_t;
+
+typedef struct {
+  band_func_t func;
+  gpointer data;
+  int firstRow;
+  int lastRow;
+  band_sync_t* sync;
+} band_task_t;
+
+static GThreadPool* bandPool = NULL;
+
+static void run_band_task(gpointer data, gpointer user_data) {
+  band_task_t* task = (band_task_t*)data;
+  band_sync_t* sync = task->sync;
+  task->func(task->data, task->firstRow, task->lastRow);
+  g_free(task);
+  g_mutex_lock(&sync->mutex);
+  sync->remaining--;
+  g_cond_signal(&sync->cond);
+  g_mutex_unlock(&sync->mutex);
+}
+
+static gpointer create_band_pool(gpointer data) {
+  return g_thread_pool_new(run_band_task, NULL, g_get_num_processors(), FALSE, NULL);
+}
+
+/* splits rows into one band per core, at least minBandRows each, the calling thread takes the last band */
+void bands_run(gpointer data, int rows, int minBandRows, band_func_t func) {
+  static GOnce poolOnce = G_ONCE_INIT;
+  int bands = MIN((int)g_get_num_processors(), MAX(1, rows / MAX(1, minBandRows)));
+  if (bands <= 1) {
+    func(data, 0, rows);
+    return;
+  }
+  bandPool = g_once(&poolOnce, create_band_pool, NULL);
+
+  band_sync_t sync;
+  g_mutex_init(&sync.mutex);
+  g_cond_init(&sync.cond);
+  sync.remaining = bands - 1;
+
+  int bandRows = (rows + bands - 1) / bands;
+  for (int i = 0; i < bands - 1; i++) {
+    band_task_t* task = g_new0(band_task_t, 1);
+    task->func = func;
+    task->data = data;
+    task->firstRow = i * bandRows;
+    task->lastRow = MIN(rows, (i + 1) * bandRows);
+    task->sync = &sync;
+    g_thread_pool_push(bandPool, task, NULL);
+  }
+  func(data, MIN(rows, (bands - 1) * bandRows), rows);
+
+  g_mutex_lock(&sync.mutex);
+  while (sync.remaining > 0) {
+    g_cond_wait(&sync.cond, &sync.mutex);
+  }
+  g_mutex_unlock(&sync.mutex);
+  g_mutex_clear(&sync.mutex);
+  g_cond_clear(&sync.cond);
+}
@@ -0,0 +1,16 @@
+#ifndef BANDS_H
+#define BANDS_H
+
+#include <glib.h>
+
+/*
+ * Runs per-row work on bands of rows in parallel, on one thread pool with a
+ * thread per core that effects and color conversion share. Returns when all
+ * bands are done.
+ */
+
+typedef void(*band_func_t)(gpointer data, int firstRow, int lastRow);
+
+void bands_run(gpointer data, int rows, int minBandRows, band_func_t func);
+
+#endif
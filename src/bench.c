@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo-pdf.h>
+#include <glib/gstdio.h>
+
+#include "loader.h"
+#include "thumbnail.h"
+#include "thumbnail-cache.h"
+#include "file-type.h"
+#include "pdf.h"
+#include "print-job.h"
+#include "trace.h"
+
+/*
+ * Headless benchmark: generates a reproducible corpus and measures listing,
+ * thumbnails, preview loads, page flips and print rasterization. Results are
+ * written as JSON, one entry per measurement.
+ *
+ *   picture-box-bench [--quick] [--corpus DIR] [--out FILE]
+ *
+ * A corpus given with --corpus is reused as is, page counts assume it was
+ * created with the same --quick setting.
+ */
+
+#define BENCH_SEED 20160101
+#define BENCH_PREVIEW_WIDTH 1920
+#define BENCH_PREVIEW_HEIGHT 1080
+#define BENCH_FLIP_PAUSE_USEC (150 * 1000) // time a customer looks at a page before flipping
+
+typedef struct {
+  int jpegCount;
+  int pngCount;
+  int pdfPages;
+  int scanPages;
+  int listingRuns;
+} bench_config_t;
+
+typedef struct {
+  GString* json;
+  gboolean first;
+} bench_results_t;
+
+static GMainLoop* printLoop = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* corpus                                                                     */
+
+/* gradients with noise, so the encoders cannot cheat with flat areas */
+static GdkPixbuf* create_test_pixbuf(GRand* rand, int width, int height) {
+  GdkPixbuf* pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  guint8* pixels = gdk_pixbuf_get_pixels(pixbuf);
+  int stride = gdk_pixbuf_get_rowstride(pixbuf);
+  int hue = g_rand_int_range(rand, 0, 256);
+  for (int y = 0; y < height; y++) {
+    guint8* row = pixels + y * stride;
+    for (int x = 0; x < width; x++) {
+      int noise = g_rand_int_range(rand, 0, 32);
+      row[x * 3] = (guint8)((x * 255 / width + hue + noise) & 0xff);
+      row[x * 3 + 1] = (guint8)((y * 255 / height + noise) & 0xff);
+      row[x * 3 + 2] = (guint8)(((x + y) * 255 / (width + height) + 255 - hue) & 0xff);
+    }
+  }
+  return pixbuf;
+}
+
+static void create_images(char* directory, GRand* rand, bench_config_t* config) {
+  static const int jpegSizes[][2] = { { 640, 480 }, { 1600, 1200 }, { 3000, 2000 }, { 4000, 3000 }, { 6000, 4000 } };
+  for (int i = 0; i < config->jpegCount; i++) {
+    const int* size = jpegSizes[i % G_N_ELEMENTS(jpegSizes)];
+    GdkPixbuf* pixbuf = create_test_pixbuf(rand, size[0], size[1]);
+    gchar* name = g_strdup_printf("photo-%04i.jpg", i);
+    gchar* path = g_build_filename(directory, name, NULL);
+    gdk_pixbuf_save(pixbuf, path, "jpeg", NULL, "quality", "90", NULL);
+    g_free(path);
+    g_free(name);
+    g_object_unref(pixbuf);
+  }
+  for (int i = 0; i < config->pngCount; i++) {
+    GdkPixbuf* pixbuf = create_test_pixbuf(rand, 6000, 6000);
+    gchar* name = g_strdup_printf("huge-%02i.png", i);
+    gchar* path = g_build_filename(directory, name, NULL);
+    gdk_pixbuf_save(pixbuf, path, "png", NULL, "compression", "1", NULL);
+    g_free(path);
+    g_free(name);
+    g_object_unref(pixbuf);
+  }
+}
+
+/* vector pages with text and shapes, like an office document */
+static void create_text_pdf(char* path, GRand* rand, int pages) {
+  cairo_surface_t* surface = cairo_pdf_surface_create(path, PRINT_A4_WIDTH, PRINT_A4_HEIGHT);
+  cairo_t* cr = cairo_create(surface);
+  cairo_select_font_face(cr, "serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, 10);
+  for (int page = 0; page < pages; page++) {
+    for (int line = 0; line < 60; line++) {
+      gchar* text = g_strdup_printf("Page %i line %i: %08x %08x %08x %08x", page + 1, line + 1,
+                                    g_rand_int(rand), g_rand_int(rand), g_rand_int(rand), g_rand_int(rand));
+      cairo_move_to(cr, 56, 60 + line * 12);
+      cairo_show_text(cr, text);
+      g_free(text);
+    }
+    for (int shape = 0; shape < 20; shape++) {
+      cairo_set_source_rgba(cr, g_rand_double(rand), g_rand_double(rand), g_rand_double(rand), 0.5);
+      cairo_arc(cr, g_rand_double_range(rand, 0, PRINT_A4_WIDTH), g_rand_double_range(rand, 0, PRINT_A4_HEIGHT), g_rand_double_range(rand, 5, 60), 0, 2 * G_PI);
+      cairo_fill(cr);
+    }
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_show_page(cr);
+  }
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+}
+
+/* one full-page 300 dpi JPEG per page, like the output of a scanner */
+static void create_scanned_pdf(char* path, GRand* rand, int pages) {
+  cairo_surface_t* surface = cairo_pdf_surface_create(path, PRINT_A4_WIDTH, PRINT_A4_HEIGHT);
+  cairo_t* cr = cairo_create(surface);
+  int width = (int)(PRINT_A4_WIDTH * 300 / 72), height = (int)(PRINT_A4_HEIGHT * 300 / 72);
+  for (int page = 0; page < pages; page++) {
+    GdkPixbuf* pixbuf = create_test_pixbuf(rand, width, height);
+    gchar* jpeg;
+    gsize jpegSize;
+    gdk_pixbuf_save_to_buffer(pixbuf, &jpeg, &jpegSize, "jpeg", NULL, "quality", "85", NULL);
+    cairo_surface_t* image = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1, NULL);
+    // embeds the JPEG data as is, instead of recompressing the pixels
+    cairo_surface_set_mime_data(image, CAIRO_MIME_TYPE_JPEG, (guchar*)jpeg, jpegSize, g_free, jpeg);
+    cairo_save(cr);
+    cairo_scale(cr, 72.0 / 300, 72.0 / 300);
+    cairo_set_source_surface(cr, image, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+    cairo_show_page(cr);
+    cairo_surface_destroy(image);
+    g_object_unref(pixbuf);
+  }
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+}
+
+static void create_corpus(char* directory, bench_config_t* config) {
+  GRand* rand = g_rand_new_with_seed(BENCH_SEED);
+  g_mkdir_with_parents(directory, 0700);
+  gint64 start = g_get_monotonic_time();
+  create_images(directory, rand, config);
+  gchar* textPath = g_build_filename(directory, "document.pdf", NULL);
+  create_text_pdf(textPath, rand, config->pdfPages);
+  gchar* scanPath = g_build_filename(directory, "scan.pdf", NULL);
+  create_scanned_pdf(scanPath, rand, config->scanPages);
+  g_free(scanPath);
+  g_free(textPath);
+  g_rand_free(rand);
+  g_printerr("Corpus created in %.1fs\n", (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+}
+
+/* ------------------------------------------------------------------------- */
+/* results                                                                    */
+
+static gint compare_doubles(gconstpointer a, gconstpointer b) {
+  double x = *(double*)a, y = *(double*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double get_percentile(GArray* sorted, double percentile) {
+  if (sorted->len == 0) {
+    return 0;
+  }
+  guint index = MIN(sorted->len - 1, (guint)(percentile * sorted->len));
+  return g_array_index(sorted, double, index);
+}
+
+/* latencies in milliseconds, throughput in items per second of total time */
+static void add_result(bench_results_t* results, char* name, GArray* latencies, double totalSeconds) {
+  g_array_sort(latencies, compare_doubles);
+  double sum = 0;
+  for (guint i = 0; i < latencies->len; i++) {
+    sum += g_array_index(latencies, double, i);
+  }
+  double mean = latencies->len ? sum / latencies->len : 0;
+  g_string_append_printf(results->json,
+    "%s    {\"name\": \"%s\", \"count\": %u, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"max_ms\": %.3f, \"per_second\": %.3f}",
+    results->first ? "" : ",\n", name, latencies->len, mean, get_percentile(latencies, 0.5), get_percentile(latencies, 0.95),
+    get_percentile(latencies, 1.0), totalSeconds > 0 ? latencies->len / totalSeconds : 0);
+  results->first = FALSE;
+  g_printerr("%-24s %5u x  p50 %9.2f ms  p95 %9.2f ms  %8.2f/s\n", name, latencies->len,
+             get_percentile(latencies, 0.5), get_percentile(latencies, 0.95), totalSeconds > 0 ? latencies->len / totalSeconds : 0);
+}
+
+static double elapsed_ms(gint64 start) {
+  return (g_get_monotonic_time() - start) / 1000.0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* measurements                                                               */
+
+static gint compare_paths(gconstpointer a, gconstpointer b) {
+  return g_strcmp0(*(char**)a, *(char**)b);
+}
+
+static GPtrArray* list_corpus(char* directory, file_type_t type) {
+  GPtrArray* files = g_ptr_array_new_with_free_func(g_free);
+  GDir* dir = g_dir_open(directory, 0, NULL);
+  const gchar* name;
+  while (dir && (name = g_dir_read_name(dir))) {
+    gchar* path = g_build_filename(directory, name, NULL);
+    if (get_file_type(path, (char*)name) == type) {
+      g_ptr_array_add(files, path);
+    } else {
+      g_free(path);
+    }
+  }
+  if (dir) {
+    g_dir_close(dir);
+  }
+  g_ptr_array_sort(files, compare_paths);
+  return files;
+}
+
+/* the same enumeration and classification as the folder view */
+static void bench_listing(bench_results_t* results, char* directory, bench_config_t* config) {
+  GArray* latencies = g_array_new(FALSE, FALSE, sizeof(double));
+  gint64 total = g_get_monotonic_time();
+  for (int run = 0; run < config->listingRuns; run++) {
+    gint64 start = g_get_monotonic_time();
+    GFile* dir = g_file_new_for_path(directory);
+    GFileEnumerator* enumerator = g_file_enumerate_children(dir, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    GFileInfo* info;
+    while (enumerator && (info = g_file_enumerator_next_file(enumerator, NULL, NULL))) {
+      const char* name = g_file_info_get_name(info);
+      gchar* path = g_build_filename(directory, name, NULL);
+      get_file_type(path, (char*)name);
+      g_free(path);
+      g_object_unref(info);
+    }
+    if (enumerator) {
+      g_object_unref(enumerator);
+    }
+    g_object_unref(dir);
+    double ms = elapsed_ms(start);
+    g_array_append_val(latencies, ms);
+  }
+  add_result(results, "directory_listing", latencies, elapsed_ms(total) / 1000);
+  g_array_free(latencies, TRUE);
+}
+
+static void bench_thumbnails(bench_results_t* results, GPtrArray* images, GPtrArray* pdfs) {
+  GArray* cold = g_array_new(FALSE, FALSE, sizeof(double));
+  GArray* warm = g_array_new(FALSE, FALSE, sizeof(double));
+  gint64 total = g_get_monotonic_time();
+  for (guint i = 0; i < images->len + pdfs->len; i++) {
+    gboolean isImage = i < images->len;
+    char* path = isImage ? g_ptr_array_index(images, i) : g_ptr_array_index(pdfs, i - images->len);
+    gint64 start = g_get_monotonic_time();
+    GdkPixbuf* pixbuf = create_thumbnail_pixbuf(path, isImage ? THUMBNAIL_IMAGE : THUMBNAIL_PDF);
+    thumbnail_cache_store(path, pixbuf);
+    double ms = elapsed_ms(start);
+    g_array_append_val(cold, ms);
+    if (pixbuf) {
+      g_object_unref(pixbuf);
+    }
+  }
+  add_result(results, "thumbnail_create", cold, elapsed_ms(total) / 1000);
+
+  total = g_get_monotonic_time();
+  for (guint i = 0; i < images->len; i++) {
+    gint64 start = g_get_monotonic_time();
+    GdkPixbuf* pixbuf = thumbnail_cache_lookup(g_ptr_array_index(images, i));
+    double ms = elapsed_ms(start);
+    g_array_append_val(warm, ms);
+    if (pixbuf) {
+      g_object_unref(pixbuf);
+    }
+  }
+  add_result(results, "thumbnail_cached", warm, elapsed_ms(total) / 1000);
+  g_array_free(cold, TRUE);
+  g_array_free(warm, TRUE);
+}
+
+/* what load_current_picture does: decode at preview size into a cairo surface, also split by format */
+static void bench_preview(bench_results_t* results, GPtrArray* images) {
+  GArray* latencies = g_array_new(FALSE, FALSE, sizeof(double));
+  GArray* jpegLatencies = g_array_new(FALSE, FALSE, sizeof(double));
+  GArray* pngLatencies = g_array_new(FALSE, FALSE, sizeof(double));
+  double jpegMs = 0, pngMs = 0;
+  gint64 total = g_get_monotonic_time();
+  for (guint i = 0; i < images->len; i++) {
+    char* path = g_ptr_array_index(images, i);
+    gint64 start = g_get_monotonic_time();
+    cairo_surface_t* surface = load_surface_at_size(path, BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT, NULL);
+    if (surface) {
+      cairo_surface_destroy(surface);
+    }
+    double ms = elapsed_ms(start);
+    g_array_append_val(latencies, ms);
+    if (g_str_has_suffix(path, ".jpg")) {
+      g_array_append_val(jpegLatencies, ms);
+      jpegMs += ms;
+    } else if (g_str_has_suffix(path, ".png")) {
+      g_array_append_val(pngLatencies, ms);
+      pngMs += ms;
+    }
+  }
+  add_result(results, "preview_load", latencies, elapsed_ms(total) / 1000);
+  add_result(results, "preview_load_jpeg", jpegLatencies, jpegMs / 1000);
+  add_result(results, "preview_load_png", pngLatencies, pngMs / 1000);
+  g_array_free(latencies, TRUE);
+  g_array_free(jpegLatencies, TRUE);
+  g_array_free(pngLatencies, TRUE);
+}
+
+/* flips forward through a document with a short pause per page, which gives prerendering a chance */
+static void bench_page_flips(bench_results_t* results, char* name, char* path, int pages) {
+  if (!open_pdf_document(path, BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT)) {
+    return;
+  }
+  GArray* latencies = g_array_new(FALSE, FALSE, sizeof(double));
+  gint64 total = g_get_monotonic_time();
+  for (int page = 0; page < pages; page++) {
+    gint64 start = g_get_monotonic_time();
+    get_pdf_cairo_surface(path, page, BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT);
+    double ms = elapsed_ms(start);
+    g_array_append_val(latencies, ms);
+    g_usleep(BENCH_FLIP_PAUSE_USEC);
+  }
+  add_result(results, name, latencies, (elapsed_ms(total) - latencies->len * BENCH_FLIP_PAUSE_USEC / 1000.0) / 1000);
+  g_array_free(latencies, TRUE);
+}
+
+typedef struct {
+  GArray* latencies;
+  gint64 lastPage;
+} bench_print_t;
+
+/* pages are written in order, the time between two of them is what a page costs in the pipeline */
+static void on_bench_print_progress(int page, int pageCount, double pagesPerSecond, gpointer data) {
+  bench_print_t* print = (bench_print_t*)data;
+  double ms = elapsed_ms(print->lastPage);
+  g_array_append_val(print->latencies, ms);
+  print->lastPage = g_get_monotonic_time();
+}
+
+static void on_bench_print_done(GError* error, gpointer data) {
+  if (error) {
+    g_printerr("Print failed: %s\n", error->message);
+  }
+  g_main_loop_quit(printLoop);
+}
+
+/* a whole print job, the latencies are the intervals between pages reaching the spool file */
+static void bench_print(bench_results_t* results, char* name, char* path, char* outputPath) {
+  if (!open_pdf_document(path, BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT)) {
+    return;
+  }
+  print_source_t* source = get_pdf_print_source(0, G_MAXINT);
+  bench_print_t print = { g_array_new(FALSE, FALSE, sizeof(double)), g_get_monotonic_time() };
+  gint64 start = print.lastPage;
+  print_job_start(source, outputPath, PRINT_DEFAULT_DPI, PRINT_A4_WIDTH, PRINT_A4_HEIGHT,
+                  on_bench_print_progress, on_bench_print_done, &print);
+  g_main_loop_run(printLoop);
+  add_result(results, name, print.latencies, elapsed_ms(start) / 1000);
+  g_array_free(print.latencies, TRUE);
+  g_unlink(outputPath);
+}
+
+/* deletes the generated corpus, thumbnails and spool files */
+static void remove_tree(char* path) {
+  GDir* dir = g_dir_open(path, 0, NULL);
+  const gchar* name;
+  while (dir && (name = g_dir_read_name(dir))) {
+    gchar* child = g_build_filename(path, name, NULL);
+    if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK)) {
+      remove_tree(child);
+    } else {
+      g_unlink(child);
+    }
+    g_free(child);
+  }
+  if (dir) {
+    g_dir_close(dir);
+  }
+  g_rmdir(path);
+}
+
+int main(int argc, char* argv[]) {
+  gboolean quick = FALSE;
+  gchar* corpus = NULL;
+  gchar* output = NULL;
+  GOptionEntry entries[] = {
+    { "quick", 'q', 0, G_OPTION_ARG_NONE, &quick, "Small corpus for a smoke test", NULL },
+    { "corpus", 'c', 0, G_OPTION_ARG_FILENAME, &corpus, "Corpus directory, created if missing", "DIR" },
+    { "out", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write the JSON results to FILE instead of stdout", "FILE" },
+    { NULL }
+  };
+  GError* error = NULL;
+  GOptionContext* context = g_option_context_new("- picture-box benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free(context);
+  trace_init();
+
+  bench_config_t config = { 200, 2, 50, 10, 20 };
+  if (quick) {
+    config = (bench_config_t){ 10, 1, 5, 2, 5 };
+  }
+  gchar* workDir = g_dir_make_tmp("picture-box-bench-XXXXXX", NULL);
+  if (NULL == corpus) {
+    corpus = g_build_filename(workDir, "corpus", NULL);
+  }
+  if (!g_file_test(corpus, G_FILE_TEST_IS_DIR)) {
+    create_corpus(corpus, &config);
+  }
+  // a private thumbnail cache, so earlier runs do not turn misses into hits
+  gchar* cacheDir = g_build_filename(workDir, "thumbnails", NULL);
+  thumbnail_cache_init(cacheDir, 0, 0);
+  printLoop = g_main_loop_new(NULL, FALSE);
+
+  bench_results_t results = { g_string_new("{\n  \"version\": 1,\n  \"results\": [\n"), TRUE };
+  GPtrArray* images = list_corpus(corpus, FILE_TYPE_IMAGE);
+  GPtrArray* pdfs = list_corpus(corpus, FILE_TYPE_PDF);
+  gchar* textPdf = g_build_filename(corpus, "document.pdf", NULL);
+  gchar* scanPdf = g_build_filename(corpus, "scan.pdf", NULL);
+  gchar* spoolPath = g_build_filename(workDir, "job.pwg", NULL);
+
+  bench_listing(&results, corpus, &config);
+  bench_thumbnails(&results, images, pdfs);
+  bench_preview(&results, images);
+  bench_page_flips(&results, "page_flip_document", textPdf, config.pdfPages);
+  bench_page_flips(&results, "page_flip_scan", scanPdf, config.scanPages);
+  bench_print(&results, "print_document", textPdf, spoolPath);
+  bench_print(&results, "print_scan", scanPdf, spoolPath);
+
+  g_string_append(results.json, "\n  ]\n}\n");
+  if (output) {
+    if (!g_file_set_contents(output, results.json->str, -1, &error)) {
+      g_printerr("%s\n", error->message);
+      remove_tree(workDir);
+      return 1;
+    }
+  } else {
+    fputs(results.json->str, stdout);
+  }
+  trace_shutdown();
+  // a corpus given with --corpus lives elsewhere and is kept
+  remove_tree(workDir);
+  g_string_free(results.json, TRUE);
+  g_ptr_array_free(images, TRUE);
+  g_ptr_array_free(pdfs, TRUE);
+  g_free(spoolPath);
+  g_free(scanPdf);
+  g_free(textPdf);
+  g_free(cacheDir);
+  g_free(workDir);
+  return 0;
+}
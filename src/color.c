@@ -0,0 +1,192 @@
+#include "color.h"
+#include "trace.h"
+#include "bands.h"
+
+#ifdef HAVE_LCMS2
+#include <lcms2.h>
+
+#define COLOR_MIN_BAND_ROWS 64
+#define COLOR_MIN_PARALLEL_PIXELS (512 * 512) // smaller surfaces, e.g. thumbnails, are converted on the calling thread
+
+/* cairo keeps pixels as native endian 32 bit words, the X byte of RGB24 is left alone */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define COLOR_TYPE_OPAQUE TYPE_BGRA_8
+#ifdef TYPE_BGRA_8_PREMUL
+#define COLOR_TYPE_ALPHA TYPE_BGRA_8_PREMUL
+#else
+#define COLOR_TYPE_ALPHA TYPE_BGRA_8
+#endif
+#else
+#define COLOR_TYPE_OPAQUE TYPE_ARGB_8
+#ifdef TYPE_ARGB_8_PREMUL
+#define COLOR_TYPE_ALPHA TYPE_ARGB_8_PREMUL
+#else
+#define COLOR_TYPE_ALPHA TYPE_ARGB_8
+#endif
+#endif
+
+struct color_transform {
+  cmsHTRANSFORM handle;
+};
+
+typedef struct {
+  color_transform_t* transform;
+  guchar* pixels;
+  int stride;
+  int width;
+} color_band_t;
+
+static GMutex transformMutex;
+static GHashTable* transforms = NULL; // "source destination intent format" -> color_transform_t, NULL when nothing to convert
+
+/* NULL stands for sRGB */
+static cmsHPROFILE open_profile(GBytes* profile) {
+  if (NULL == profile) {
+    return cmsCreate_sRGBProfile();
+  }
+  gsize length;
+  const void* data = g_bytes_get_data(profile, &length);
+  return cmsOpenProfileFromMem(data, length);
+}
+
+/* cameras mostly embed sRGB itself, converting to sRGB would only cost time */
+static gboolean is_srgb(cmsHPROFILE profile) {
+  char description[256];
+  if (0 == cmsGetProfileInfoASCII(profile, cmsInfoDescription, "en", "US", description, sizeof(description))) {
+    return FALSE;
+  }
+  return g_str_has_prefix(description, "sRGB");
+}
+
+static color_transform_t* create_transform(GBytes* source, GBytes* destination, color_intent_t intent, cairo_format_t format) {
+  cmsHPROFILE input = open_profile(source);
+  cmsHPROFILE output = open_profile(destination);
+  color_transform_t* transform = NULL;
+  // gray and CMYK profiles describe data the decoders already turned into RGB
+  if (input && output && cmsGetColorSpace(input) == cmsSigRgbData && cmsGetColorSpace(output) == cmsSigRgbData
+      && !(NULL == destination && is_srgb(input))) {
+    cmsUInt32Number type = format == CAIRO_FORMAT_ARGB32 ? COLOR_TYPE_ALPHA : COLOR_TYPE_OPAQUE;
+    // no cache, the bands of one surface run through the same transform at once
+    cmsUInt32Number flags = cmsFLAGS_NOCACHE | cmsFLAGS_BLACKPOINTCOMPENSATION | cmsFLAGS_COPY_ALPHA;
+    cmsHTRANSFORM handle = cmsCreateTransform(input, type, output, type, intent, flags);
+    if (handle) {
+      transform = g_new0(color_transform_t, 1);
+      transform->handle = handle;
+    }
+  }
+  if (input) {
+    cmsCloseProfile(input);
+  }
+  if (output) {
+    cmsCloseProfile(output);
+  }
+  return transform;
+}
+
+gboolean color_is_enabled() {
+  return TRUE;
+}
+
+/*
+ * The transform from source to destination, either NULL for sRGB. Transforms
+ * are created once and kept for the session, a session sees a handful of
+ * profiles. Returns NULL when there is nothing to convert.
+ */
+color_transform_t* color_get_transform(GBytes* source, GBytes* destination, color_intent_t intent, cairo_format_t format) {
+  if (NULL == source && NULL == destination) {
+    return NULL;
+  }
+  gchar* sourceSum = source ? g_compute_checksum_for_bytes(G_CHECKSUM_MD5, source) : g_strdup("srgb");
+  gchar* destinationSum = destination ? g_compute_checksum_for_bytes(G_CHECKSUM_MD5, destination) : g_strdup("srgb");
+  gboolean same = g_str_equal(sourceSum, destinationSum);
+  gchar* key = g_strdup_printf("%s %s %i %i", sourceSum, destinationSum, intent, format);
+  g_free(sourceSum);
+  g_free(destinationSum);
+  if (same) {
+    g_free(key);
+    return NULL;
+  }
+
+  g_mutex_lock(&transformMutex);
+  if (NULL == transforms) {
+    transforms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  }
+  color_transform_t* transform = NULL;
+  if (g_hash_table_lookup_extended(transforms, key, NULL, (gpointer*)&transform)) {
+    g_free(key);
+  } else {
+    TRACE_SCOPE("color create transform");
+    transform = create_transform(source, destination, intent, format);
+    g_hash_table_insert(transforms, key, transform);
+  }
+  g_mutex_unlock(&transformMutex);
+  return transform;
+}
+
+/* converts rows of cairo pixels in place, the transform decides the pixel format */
+void color_transform_rows(color_transform_t* transform, guchar* pixels, int stride, int width, int rows) {
+  cmsDoTransformLineStride(transform->handle, pixels, pixels, width, rows, stride, stride, 0, 0);
+}
+
+static void transform_band(color_band_t* band, int firstRow, int lastRow) {
+  color_transform_rows(band->transform, band->pixels + (gsize)firstRow * band->stride, band->stride, band->width, lastRow - firstRow);
+}
+
+/* converts surface in place, large surfaces in one band per core */
+void color_transform_surface(color_transform_t* transform, cairo_surface_t* surface) {
+  TRACE_SCOPE("color transform");
+  int rows = cairo_image_surface_get_height(surface);
+  cairo_surface_flush(surface);
+  color_band_t band;
+  band.transform = transform;
+  band.pixels = cairo_image_surface_get_data(surface);
+  band.stride = cairo_image_surface_get_stride(surface);
+  band.width = cairo_image_surface_get_width(surface);
+  int minBandRows = (gint64)band.width * rows < COLOR_MIN_PARALLEL_PIXELS ? rows : COLOR_MIN_BAND_ROWS;
+  bands_run(&band, rows, minBandRows, (band_func_t)transform_band);
+  cairo_surface_mark_dirty(surface);
+}
+
+static gpointer load_printer_profile(gpointer data) {
+  const char* filename = g_getenv("PICTURE_BOX_PRINTER_PROFILE");
+  gchar* contents;
+  gsize length;
+  GError* error = NULL;
+  if (NULL == filename || 0 == filename[0]) {
+    return NULL;
+  }
+  if (!g_file_get_contents(filename, &contents, &length, &error)) {
+    g_print("Printer profile not loaded: %s\n", error->message);
+    g_error_free(error);
+    return NULL;
+  }
+  return g_bytes_new_take(contents, length);
+}
+
+/* the ICC profile print rasters are converted to, NULL when printing sRGB */
+GBytes* color_get_printer_profile() {
+  static GOnce profileOnce = G_ONCE_INIT;
+  return g_once(&profileOnce, load_printer_profile, NULL);
+}
+
+#else
+
+gboolean color_is_enabled() {
+  return FALSE;
+}
+
+color_transform_t* color_get_transform(GBytes* source, GBytes* destination, color_intent_t intent, cairo_format_t format) {
+  return NULL;
+}
+
+void color_transform_rows(color_transform_t* transform, guchar* pixels, int stride, int width, int rows) {
+}
+
+void color_transform_surface(color_transform_t* transform, cairo_surface_t* surface) {
+}
+
+GBytes* color_get_printer_profile() {
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Color management with lcms2. Decoded pictures are converted from their
+ * embedded ICC profile to sRGB, the space the display and the edits work in,
+ * and print rasters from sRGB to the printer profile that
+ * PICTURE_BOX_PRINTER_PROFILE names. Built without lcms2, there are no
+ * transforms and pixels stay as decoded.
+ */
+
+typedef enum { // ICC rendering intents, in ICC order
+  COLOR_INTENT_PERCEPTUAL,
+  COLOR_INTENT_RELATIVE_COLORIMETRIC,
+  COLOR_INTENT_SATURATION,
+  COLOR_INTENT_ABSOLUTE_COLORIMETRIC
+} color_intent_t;
+
+typedef struct color_transform color_transform_t;
+
+gboolean color_is_enabled();
+color_transform_t* color_get_transform(GBytes* source, GBytes* destination, color_intent_t intent, cairo_format_t format);
+void color_transform_rows(color_transform_t* transform, guchar* pixels, int stride, int width, int rows);
+void color_transform_surface(color_transform_t* transform, cairo_surface_t* surface);
+GBytes* color_get_printer_profile();
+
+#endif
@@ -0,0 +1,547 @@
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+#include <png.h>
+#ifdef HAVE_LIBWEBP
+#include <webp/decode.h>
+#endif
+#ifdef HAVE_LIBHEIF
+#include <libheif/heif.h>
+#endif
+
+#include "decoder.h"
+#include "exif.h"
+
+#define JPEG_ROWS_PER_READ 16
+#define DECODER_MAX_SIZE 32767 // the largest width or height of a cairo image surface
+#define DECODER_MAX_PROFILE_SIZE (4 * 1024 * 1024) // real ICC profiles stay far below
+
+/* scale that brings width x height to the box, above 1.0 when the picture is smaller */
+static double get_scale(decode_size_t* size, int width, int height) {
+  if (size->width <= 0 || size->height <= 0) {
+    return 1.0;
+  }
+  double wScale = (double)size->width / width;
+  double hScale = (double)size->height / height;
+  return size->cover ? MAX(wScale, hScale) : MIN(wScale, hScale);
+}
+
+static guint32 read_be32(const guchar* p) {
+  return (guint32)p[0] << 24 | (guint32)p[1] << 16 | (guint32)p[2] << 8 | p[3];
+}
+
+static inline guint32 premultiply(guint r, guint g, guint b, guint a) {
+  if (a == 0) {
+    return 0;
+  }
+  if (a < 255) {
+    r = (r * a + 127) / 255;
+    g = (g * a + 127) / 255;
+    b = (b * a + 127) / 255;
+  }
+  return (guint32)a << 24 | r << 16 | g << 8 | b;
+}
+
+/* a surface to decode into, NULL with error set when cairo cannot make it, e.g. out of memory */
+static cairo_surface_t* create_surface(cairo_format_t format, int width, int height, GError** error) {
+  cairo_surface_t* surface = cairo_image_surface_create(format, width, height);
+  cairo_status_t status = cairo_surface_status(surface);
+  if (status != CAIRO_STATUS_SUCCESS) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY, "Cannot decode at %ix%i: %s",
+                width, height, cairo_status_to_string(status));
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  return surface;
+}
+
+/* ------------------------------------------------------------------------- */
+/* orientation                                                                */
+
+/* same mapping as apply_exif_orientation, on a surface */
+static cairo_surface_t* orient_surface(cairo_surface_t* surface, int orientation) {
+  if (orientation < 2 || orientation > 8) {
+    return surface;
+  }
+  int width = cairo_image_surface_get_width(surface);
+  int height = cairo_image_surface_get_height(surface);
+  gboolean sideways = orientation >= 5;
+  cairo_matrix_t matrix;
+  switch (orientation) {
+    case 2: cairo_matrix_init(&matrix, -1, 0, 0, 1, width, 0); break;
+    case 3: cairo_matrix_init(&matrix, -1, 0, 0, -1, width, height); break;
+    case 4: cairo_matrix_init(&matrix, 1, 0, 0, -1, 0, height); break;
+    case 5: cairo_matrix_init(&matrix, 0, 1, 1, 0, 0, 0); break;
+    case 6: cairo_matrix_init(&matrix, 0, 1, -1, 0, height, 0); break;
+    case 7: cairo_matrix_init(&matrix, 0, -1, -1, 0, height, width); break;
+    default: cairo_matrix_init(&matrix, 0, -1, 1, 0, 0, width); break;
+  }
+  cairo_surface_t* result = create_surface(cairo_image_surface_get_format(surface),
+    sideways ? height : width, sideways ? width : height, NULL);
+  if (NULL == result) {
+    return surface; // shown turned rather than not at all
+  }
+  cairo_t* cr = cairo_create(result);
+  cairo_set_matrix(cr, &matrix);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+  return result;
+}
+
+/* scales surface down to the box when the codec decoded it larger, consumes surface */
+cairo_surface_t* decoder_fit_surface(cairo_surface_t* surface, decode_size_t* size) {
+  int width = cairo_image_surface_get_width(surface);
+  int height = cairo_image_surface_get_height(surface);
+  double scale = get_scale(size, width, height);
+  if (scale >= 1.0) {
+    return surface;
+  }
+  int fitWidth = MAX(1, (int)(width * scale + 0.5));
+  int fitHeight = MAX(1, (int)(height * scale + 0.5));
+  cairo_surface_t* result = create_surface(cairo_image_surface_get_format(surface), fitWidth, fitHeight, NULL);
+  if (NULL == result) {
+    return surface;
+  }
+  cairo_t* cr = cairo_create(result);
+  cairo_scale(cr, (double)fitWidth / width, (double)fitHeight / height);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+  return result;
+}
+
+/* ------------------------------------------------------------------------- */
+/* JPEG, libjpeg-turbo                                                        */
+
+typedef struct {
+  struct jpeg_error_mgr manager;
+  jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+} jpeg_error_t;
+
+static void on_jpeg_error(j_common_ptr info) {
+  jpeg_error_t* error = (jpeg_error_t*)info->err;
+  error->manager.format_message(info, error->message);
+  longjmp(error->jump, 1);
+}
+
+/* warnings about corrupt data are not worth a line each, the picture is shown anyway */
+static void on_jpeg_message(j_common_ptr info, int level) {
+}
+
+static gboolean probe_jpeg(const guchar* data, gsize length) {
+  return length >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+/* the Adobe CMYK that Photoshop writes is stored inverted */
+static void convert_cmyk_row(const guchar* cmyk, guint32* out, int width) {
+  for (int x = 0; x < width; x++, cmyk += 4) {
+    guint k = cmyk[3];
+    out[x] = 0xFF000000 | (cmyk[0] * k / 255) << 16 | (cmyk[1] * k / 255) << 8 | (cmyk[2] * k / 255);
+  }
+}
+
+static cairo_surface_t* decode_jpeg(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  struct jpeg_decompress_struct info;
+  jpeg_error_t jpegError;
+  cairo_surface_t* volatile surface = NULL;
+  guchar* volatile cmykRows = NULL;
+
+  info.err = jpeg_std_error(&jpegError.manager);
+  jpegError.manager.error_exit = on_jpeg_error;
+  jpegError.manager.emit_message = on_jpeg_message;
+  if (setjmp(jpegError.jump)) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s", jpegError.message);
+    jpeg_destroy_decompress(&info);
+    g_free(cmykRows);
+    if (surface) {
+      cairo_surface_destroy(surface);
+    }
+    return NULL;
+  }
+  jpeg_create_decompress(&info);
+  jpeg_mem_src(&info, (unsigned char*)data, length);
+  jpeg_read_header(&info, TRUE);
+
+  // DCT scaling in eighths, the smallest that still reaches the box
+  double scale = get_scale(size, info.image_width, info.image_height);
+  if (scale < 1.0) {
+    info.scale_num = CLAMP((int)ceil(scale * 8), 1, 8);
+    info.scale_denom = 8;
+  }
+  // very wide or tall pictures cover a box at full size, they are scaled down to what cairo can hold;
+  // JPEG sides end at 65500, so at least 4/8 always fits
+  int limit = (int)((gint64)DECODER_MAX_SIZE * 8 / MAX(info.image_width, info.image_height));
+  if (limit < 8) {
+    info.scale_num = MIN(scale < 1.0 ? (int)info.scale_num : 8, limit);
+    info.scale_denom = 8;
+  }
+  gboolean cmyk = info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  info.out_color_space = cmyk ? JCS_CMYK : JCS_EXT_BGRX;
+#else
+  info.out_color_space = cmyk ? JCS_CMYK : JCS_EXT_XRGB;
+#endif
+  jpeg_calc_output_dimensions(&info);
+  surface = create_surface(CAIRO_FORMAT_RGB24, info.output_width, info.output_height, error);
+  if (NULL == surface) {
+    jpeg_destroy_decompress(&info);
+    return NULL;
+  }
+  jpeg_start_decompress(&info);
+  guchar* pixels = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  JSAMPROW rows[JPEG_ROWS_PER_READ];
+  if (cmyk) {
+    cmykRows = g_malloc((gsize)info.output_width * 4 * JPEG_ROWS_PER_READ);
+  }
+  while (info.output_scanline < info.output_height) {
+    JDIMENSION first = info.output_scanline;
+    int count = MIN(JPEG_ROWS_PER_READ, (int)(info.output_height - first));
+    for (int i = 0; i < count; i++) {
+      // RGB is written straight into the surface rows
+      rows[i] = cmyk ? cmykRows + (gsize)i * info.output_width * 4 : pixels + (gsize)(first + i) * stride;
+    }
+    JDIMENSION read = jpeg_read_scanlines(&info, rows, count);
+    for (JDIMENSION i = 0; cmyk && i < read; i++) {
+      convert_cmyk_row(rows[i], (guint32*)(pixels + (gsize)(first + i) * stride), info.output_width);
+    }
+  }
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+  g_free(cmykRows);
+  cairo_surface_mark_dirty(surface);
+  return surface;
+}
+
+/* ICC profiles are split over APP2 segments: "ICC_PROFILE\0", sequence number from 1, count */
+static GBytes* get_jpeg_profile(const guchar* data, gsize length) {
+  const guchar* parts[256] = { NULL };
+  gsize sizes[256] = { 0 };
+  int count = 0;
+  gsize offset = 2;
+  while (offset + 4 <= length && data[offset] == 0xFF) {
+    guint marker = data[offset + 1];
+    gsize size = (data[offset + 2] << 8 | data[offset + 3]);
+    if (size < 2 || marker == 0xDA) {
+      break; // start of scan, no more metadata
+    }
+    size -= 2;
+    offset += 4;
+    if (size > length - offset) {
+      break;
+    }
+    if (marker == 0xE2 && size > 14 && memcmp(data + offset, "ICC_PROFILE\0", 12) == 0) {
+      guint sequence = data[offset + 12];
+      count = data[offset + 13];
+      if (sequence >= 1 && sequence <= (guint)count) {
+        parts[sequence] = data + offset + 14;
+        sizes[sequence] = size - 14;
+      }
+    }
+    offset += size;
+  }
+  GByteArray* profile = count > 0 ? g_byte_array_new() : NULL;
+  for (int i = 1; profile && i <= count; i++) {
+    if (NULL == parts[i]) {
+      g_byte_array_unref(profile);
+      return NULL;
+    }
+    g_byte_array_append(profile, parts[i], sizes[i]);
+  }
+  return profile ? g_byte_array_free_to_bytes(profile) : NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* PNG, libpng                                                                */
+
+static gboolean probe_png(const guchar* data, gsize length) {
+  return length >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0;
+}
+
+/* PNG has no reduced decoding, the picture is decoded in full and scaled afterwards */
+static cairo_surface_t* decode_png(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&image, data, length)) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s", image.message);
+    return NULL;
+  }
+  gboolean alpha = (image.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  image.format = PNG_FORMAT_BGRA;
+#else
+  image.format = PNG_FORMAT_ARGB;
+#endif
+  cairo_surface_t* surface = image.width > DECODER_MAX_SIZE || image.height > DECODER_MAX_SIZE ? NULL
+    : create_surface(alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24, image.width, image.height, error);
+  if (NULL == surface) {
+    if (error && NULL == *error) {
+      g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY, "%ux%u is too large", image.width, image.height);
+    }
+    png_image_free(&image);
+    return NULL;
+  }
+  guchar* pixels = cairo_image_surface_get_data(surface);
+  int stride = cairo_image_surface_get_stride(surface);
+  if (!png_image_finish_read(&image, NULL, pixels, stride, NULL)) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s", image.message);
+    png_image_free(&image);
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  for (guint y = 0; alpha && y < image.height; y++) {
+    guint32* row = (guint32*)(pixels + (gsize)y * stride);
+    for (guint x = 0; x < image.width; x++) {
+      guint32 p = row[x];
+      row[x] = premultiply(p >> 16 & 0xFF, p >> 8 & 0xFF, p & 0xFF, p >> 24);
+    }
+  }
+  cairo_surface_mark_dirty(surface);
+  return surface;
+}
+
+/* inflates at most maxLength bytes, NULL when the stream is broken or longer */
+static GBytes* inflate_zlib(const guchar* data, gsize length, gsize maxLength) {
+  GConverter* decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+  GByteArray* output = g_byte_array_new();
+  guchar buffer[16384];
+  GConverterResult result;
+  do {
+    gsize read = 0, written = 0;
+    result = g_converter_convert(decompressor, data, length, buffer, sizeof(buffer), G_CONVERTER_INPUT_AT_END, &read, &written, NULL);
+    g_byte_array_append(output, buffer, written);
+    data += read;
+    length -= read;
+    if (read == 0 && written == 0 && result != G_CONVERTER_FINISHED) {
+      result = G_CONVERTER_ERROR; // truncated stream
+    }
+    if (output->len > maxLength) {
+      result = G_CONVERTER_ERROR;
+    }
+  } while (result != G_CONVERTER_FINISHED && result != G_CONVERTER_ERROR);
+  g_object_unref(decompressor);
+  if (result != G_CONVERTER_FINISHED) {
+    g_byte_array_unref(output);
+    return NULL;
+  }
+  return g_byte_array_free_to_bytes(output);
+}
+
+/* the iCCP chunk: profile name, compression method, zlib stream; it always comes before the image data */
+static GBytes* get_png_profile(const guchar* data, gsize length) {
+  gsize offset = 8;
+  while (offset + 12 <= length) {
+    gsize size = read_be32(data + offset);
+    const guchar* type = data + offset + 4;
+    const guchar* chunk = data + offset + 8;
+    if (size > length - offset - 12 || memcmp(type, "IDAT", 4) == 0) {
+      break;
+    }
+    if (memcmp(type, "iCCP", 4) == 0) {
+      const guchar* name = memchr(chunk, 0, MIN(size, 80));
+      if (NULL == name || name + 2 > chunk + size) {
+        return NULL;
+      }
+      return inflate_zlib(name + 2, chunk + size - (name + 2), DECODER_MAX_PROFILE_SIZE);
+    }
+    offset += size + 12;
+  }
+  return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* WebP, libwebp                                                              */
+
+#ifdef HAVE_LIBWEBP
+static gboolean probe_webp(const guchar* data, gsize length) {
+  return length >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0;
+}
+
+static cairo_surface_t* decode_webp(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  WebPDecoderConfig config;
+  if (!WebPInitDecoderConfig(&config) || WebPGetFeatures(data, length, &config.input) != VP8_STATUS_OK) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "Not a WebP image");
+    return NULL;
+  }
+  int width = config.input.width;
+  int height = config.input.height;
+  double scale = get_scale(size, width, height);
+  if (scale < 1.0) {
+    config.options.use_scaling = 1;
+    config.options.scaled_width = width = MAX(1, (int)(width * scale + 0.5));
+    config.options.scaled_height = height = MAX(1, (int)(height * scale + 0.5));
+  }
+  gboolean alpha = config.input.has_alpha;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+  config.output.colorspace = alpha ? MODE_bgrA : MODE_BGRA;
+#else
+  config.output.colorspace = alpha ? MODE_Argb : MODE_ARGB;
+#endif
+  cairo_surface_t* surface = create_surface(alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24, width, height, error);
+  if (NULL == surface) {
+    return NULL;
+  }
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = cairo_image_surface_get_data(surface);
+  config.output.u.RGBA.stride = cairo_image_surface_get_stride(surface);
+  config.output.u.RGBA.size = (size_t)config.output.u.RGBA.stride * height;
+  VP8StatusCode status = WebPDecode(data, length, &config);
+  WebPFreeDecBuffer(&config.output);
+  if (status != VP8_STATUS_OK) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "WebP decoding failed (%d)", status);
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  cairo_surface_mark_dirty(surface);
+  return surface;
+}
+
+/* RIFF chunks: fourcc, little endian size, data padded to an even length */
+static GBytes* get_webp_profile(const guchar* data, gsize length) {
+  gsize offset = 12;
+  while (offset + 8 <= length) {
+    const guchar* p = data + offset + 4;
+    gsize size = (guint32)p[3] << 24 | (guint32)p[2] << 16 | (guint32)p[1] << 8 | p[0];
+    if (size > length - offset - 8) {
+      break;
+    }
+    if (memcmp(data + offset, "ICCP", 4) == 0) {
+      return g_bytes_new(data + offset + 8, size);
+    }
+    offset += 8 + size + (size & 1);
+  }
+  return NULL;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* HEIF, libheif                                                              */
+
+#ifdef HAVE_LIBHEIF
+static gboolean probe_heif(const guchar* data, gsize length) {
+  static const char* brands[] = { "heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1", NULL };
+  if (length < 12 || memcmp(data + 4, "ftyp", 4) != 0) {
+    return FALSE;
+  }
+  for (int i = 0; brands[i]; i++) {
+    if (memcmp(data + 8, brands[i], 4) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* libheif applies the rotation and mirroring stored in the container itself */
+static cairo_surface_t* decode_heif(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  struct heif_context* context = heif_context_alloc();
+  struct heif_image_handle* handle = NULL;
+  struct heif_image* image = NULL;
+  cairo_surface_t* surface = NULL;
+  struct heif_error result = heif_context_read_from_memory_without_copy(context, data, length, NULL);
+  if (result.code == heif_error_Ok) {
+    result = heif_context_get_primary_image_handle(context, &handle);
+  }
+  gboolean alpha = handle && heif_image_handle_has_alpha_channel(handle);
+  if (result.code == heif_error_Ok) {
+    result = heif_decode_image(handle, &image, heif_colorspace_RGB,
+      alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB, NULL);
+  }
+  if (result.code != heif_error_Ok) {
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s", result.message);
+  } else {
+    int width = heif_image_get_width(image, heif_channel_interleaved);
+    int height = heif_image_get_height(image, heif_channel_interleaved);
+    int sourceStride;
+    const guchar* source = heif_image_get_plane_readonly(image, heif_channel_interleaved, &sourceStride);
+    surface = create_surface(alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24, width, height, error);
+    guchar* pixels = surface ? cairo_image_surface_get_data(surface) : NULL;
+    int stride = surface ? cairo_image_surface_get_stride(surface) : 0;
+    int channels = alpha ? 4 : 3;
+    for (int y = 0; surface && y < height; y++) {
+      const guchar* in = source + (gsize)y * sourceStride;
+      guint32* out = (guint32*)(pixels + (gsize)y * stride);
+      for (int x = 0; x < width; x++, in += channels) {
+        out[x] = premultiply(in[0], in[1], in[2], alpha ? in[3] : 255);
+      }
+    }
+    if (surface) {
+      cairo_surface_mark_dirty(surface);
+    }
+  }
+  if (image) {
+    heif_image_release(image);
+  }
+  if (handle) {
+    heif_image_handle_release(handle);
+  }
+  heif_context_free(context);
+  return surface;
+}
+
+/* parses the container a second time, which reads boxes but decodes nothing */
+static GBytes* get_heif_profile(const guchar* data, gsize length) {
+  struct heif_context* context = heif_context_alloc();
+  struct heif_image_handle* handle = NULL;
+  GBytes* profile = NULL;
+  if (heif_context_read_from_memory_without_copy(context, data, length, NULL).code == heif_error_Ok
+      && heif_context_get_primary_image_handle(context, &handle).code == heif_error_Ok) {
+    // 0 for none and for profiles given as color primaries (nclx)
+    size_t size = heif_image_handle_get_raw_color_profile_size(handle);
+    guchar* bytes = size > 0 ? g_malloc(size) : NULL;
+    if (bytes && heif_image_handle_get_raw_color_profile(handle, bytes).code == heif_error_Ok) {
+      profile = g_bytes_new_take(bytes, size);
+    } else {
+      g_free(bytes);
+    }
+  }
+  if (handle) {
+    heif_image_handle_release(handle);
+  }
+  heif_context_free(context);
+  return profile;
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+/* JPEGs carry their orientation in EXIF, the box is turned before decoding and the picture after */
+static cairo_surface_t* decode_oriented_jpeg(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  int orientation = get_exif_orientation(data, length);
+  decode_size_t turned = { size->height, size->width, size->cover };
+  cairo_surface_t* surface = decode_jpeg(data, length, orientation >= 5 ? &turned : size, error);
+  return surface ? orient_surface(surface, orientation) : NULL;
+}
+
+static const decoder_t decoders[] = {
+  { "jpeg", "decode jpeg", probe_jpeg, decode_oriented_jpeg, get_jpeg_profile },
+  { "png", "decode png", probe_png, decode_png, get_png_profile },
+#ifdef HAVE_LIBWEBP
+  { "webp", "decode webp", probe_webp, decode_webp, get_webp_profile },
+#endif
+#ifdef HAVE_LIBHEIF
+  { "heif", "decode heif", probe_heif, decode_heif, get_heif_profile },
+#endif
+  { NULL }
+};
+
+/* the decoder for data by its signature, NULL when GdkPixbuf has to do it */
+const decoder_t* decoder_find(const guchar* data, gsize length) {
+  for (int i = 0; decoders[i].name; i++) {
+    if (decoders[i].probe(data, length)) {
+      return &decoders[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Decoders that call the codec libraries directly and write into the pixel
+ * layout of cairo image surfaces: RGB24 for opaque pictures, premultiplied
+ * ARGB32 otherwise. Formats without one go through GdkPixbuf in loader.c.
+ * Pixels are left in the color space of the file, see get_profile.
+ */
+
+typedef struct {
+  int width;
+  int height;
+  gboolean cover; // fill the box instead of fitting into it
+} decode_size_t;
+
+typedef struct {
+  const char* name;
+  const char* traceName; // per format decode times in the trace and stats
+  gboolean(*probe)(const guchar* data, gsize length);
+  /* decodes at the given size or larger, codecs that can scale while decoding do so */
+  cairo_surface_t*(*decode)(const guchar* data, gsize length, decode_size_t* size, GError** error);
+  /* the embedded ICC profile, NULL if there is none */
+  GBytes*(*get_profile)(const guchar* data, gsize length);
+} decoder_t;
+
+const decoder_t* decoder_find(const guchar* data, gsize length);
+cairo_surface_t* decoder_fit_surface(cairo_surface_t* surface, decode_size_t* size);
+
+#endif
@@ -0,0 +1,260 @@
+#include <math.h>
+
+#include "edit-stack.h"
+#include "memory-budget.h"
+
+#define EDIT_MERGE_USEC (500 * 1000) // changes to the same operation closer than this are one undo step
+
+typedef struct {
+  edit_op_t op;
+  cairo_surface_t* output;
+} edit_node_t;
+
+struct edit_stack {
+  cairo_surface_t* source;
+  GPtrArray* history; // GArray of edit_op_t per undo step, the first one is empty
+  guint position; // index of the current step in history
+  GPtrArray* nodes; // edit_node_t, cached output of each operation of the last render
+  edit_kind_t lastKind;
+  gint64 lastChange;
+};
+
+static void free_node(edit_node_t* node) {
+  memory_budget_release(MEMORY_POOL_PREVIEWS, memory_get_surface_bytes(node->output));
+  cairo_surface_destroy(node->output);
+  g_free(node);
+}
+
+static GArray* get_current_ops(edit_stack_t* stack) {
+  return g_ptr_array_index(stack->history, stack->position);
+}
+
+static gboolean effects_equal(effect_params_t* a, effect_params_t* b) {
+  return a->brightness == b->brightness && a->contrast == b->contrast
+    && a->grayscale == b->grayscale && a->sepia == b->sepia && a->autoLevels == b->autoLevels
+    && a->sharpen == b->sharpen
+    && a->redEye.x == b->redEye.x && a->redEye.y == b->redEye.y
+    && a->redEye.width == b->redEye.width && a->redEye.height == b->redEye.height;
+}
+
+static gboolean ops_equal(edit_op_t* a, edit_op_t* b) {
+  if (a->kind != b->kind) {
+    return FALSE;
+  }
+  switch (a->kind) {
+    case EDIT_CROP:
+      return a->cropX == b->cropX && a->cropY == b->cropY && a->cropWidth == b->cropWidth && a->cropHeight == b->cropHeight;
+    case EDIT_ROTATE:
+      return a->quarterTurns == b->quarterTurns;
+    case EDIT_EFFECTS:
+      return effects_equal(&a->effects, &b->effects);
+  }
+  return FALSE;
+}
+
+static cairo_format_t get_output_format(cairo_surface_t* input) {
+  return cairo_image_surface_get_format(input) == CAIRO_FORMAT_ARGB32 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+}
+
+static cairo_surface_t* apply_crop(cairo_surface_t* input, edit_op_t* op) {
+  int width = cairo_image_surface_get_width(input);
+  int height = cairo_image_surface_get_height(input);
+  int x = CLAMP((int)(op->cropX * width + 0.5), 0, width - 1);
+  int y = CLAMP((int)(op->cropY * height + 0.5), 0, height - 1);
+  int cropWidth = CLAMP((int)(op->cropWidth * width + 0.5), 1, width - x);
+  int cropHeight = CLAMP((int)(op->cropHeight * height + 0.5), 1, height - y);
+
+  cairo_surface_t* output = cairo_image_surface_create(get_output_format(input), cropWidth, cropHeight);
+  cairo_t* cr = cairo_create(output);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_surface(cr, input, -x, -y);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  return output;
+}
+
+static cairo_surface_t* apply_rotate(cairo_surface_t* input, edit_op_t* op) {
+  int turns = ((op->quarterTurns % 4) + 4) % 4;
+  if (turns == 0) {
+    return cairo_surface_reference(input);
+  }
+  int width = cairo_image_surface_get_width(input);
+  int height = cairo_image_surface_get_height(input);
+  int outWidth = turns % 2 ? height : width;
+  int outHeight = turns % 2 ? width : height;
+
+  cairo_surface_t* output = cairo_image_surface_create(get_output_format(input), outWidth, outHeight);
+  cairo_t* cr = cairo_create(output);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_translate(cr, outWidth / 2.0, outHeight / 2.0);
+  cairo_rotate(cr, turns * M_PI / 2);
+  cairo_translate(cr, -width / 2.0, -height / 2.0);
+  cairo_set_source_surface(cr, input, 0, 0);
+  // quarter turns map pixels onto pixels, filtering would only blur
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  return output;
+}
+
+/* scale converts pixels of the stack source to pixels of the surface being processed */
+static cairo_surface_t* apply_op(cairo_surface_t* input, edit_op_t* op, double scale) {
+  switch (op->kind) {
+    case EDIT_CROP:
+      return apply_crop(input, op);
+    case EDIT_ROTATE:
+      return apply_rotate(input, op);
+    case EDIT_EFFECTS: {
+      effect_params_t params = op->effects;
+      params.redEye.x = (int)(params.redEye.x * scale);
+      params.redEye.y = (int)(params.redEye.y * scale);
+      params.redEye.width = (int)ceil(params.redEye.width * scale);
+      params.redEye.height = (int)ceil(params.redEye.height * scale);
+      return effects_apply(input, &params);
+    }
+  }
+  return cairo_surface_reference(input);
+}
+
+/*
+ * Creates an empty edit stack for source. Operations are kept as a list per
+ * undo step and rendered lazily, so edits never touch the source itself.
+ */
+edit_stack_t* edit_stack_new(cairo_surface_t* source) {
+  edit_stack_t* stack = (edit_stack_t*)g_malloc0(sizeof(edit_stack_t));
+  stack->source = cairo_surface_reference(source);
+  stack->history = g_ptr_array_new_with_free_func((GDestroyNotify)g_array_unref);
+  g_ptr_array_add(stack->history, g_array_new(FALSE, TRUE, sizeof(edit_op_t)));
+  stack->nodes = g_ptr_array_new_with_free_func((GDestroyNotify)free_node);
+  return stack;
+}
+
+void edit_stack_free(edit_stack_t* stack) {
+  g_ptr_array_free(stack->nodes, TRUE);
+  g_ptr_array_free(stack->history, TRUE);
+  cairo_surface_destroy(stack->source);
+  g_free(stack);
+}
+
+/* the current operations on the same source without history or cache, e.g. for output on another thread */
+edit_stack_t* edit_stack_copy(edit_stack_t* stack) {
+  edit_stack_t* copy = edit_stack_new(stack->source);
+  GArray* current = get_current_ops(stack);
+  if (current->len > 0) {
+    GArray* ops = g_array_sized_new(FALSE, TRUE, sizeof(edit_op_t), current->len);
+    g_array_append_vals(ops, current->data, current->len);
+    g_ptr_array_add(copy->history, ops);
+    copy->position = 1;
+  }
+  return copy;
+}
+
+/* copies the current operation of kind into op, FALSE if there is none */
+gboolean edit_stack_get_op(edit_stack_t* stack, edit_kind_t kind, edit_op_t* op) {
+  GArray* ops = get_current_ops(stack);
+  for (guint i = 0; i < ops->len; i++) {
+    if (g_array_index(ops, edit_op_t, i).kind == kind) {
+      *op = g_array_index(ops, edit_op_t, i);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*
+ * Replaces the operation of the same kind, or appends op, as a new undo step.
+ * Quick successive changes to one operation, e.g. a slider drag, are merged.
+ */
+void edit_stack_set_op(edit_stack_t* stack, edit_op_t* op) {
+  gint64 now = g_get_monotonic_time();
+  gboolean merge = stack->position > 0 && stack->position == stack->history->len - 1
+    && stack->lastKind == op->kind && now - stack->lastChange < EDIT_MERGE_USEC;
+  GArray* current = get_current_ops(stack);
+  GArray* ops = g_array_sized_new(FALSE, TRUE, sizeof(edit_op_t), current->len + 1);
+  g_array_append_vals(ops, current->data, current->len);
+
+  guint i = 0;
+  while (i < ops->len && g_array_index(ops, edit_op_t, i).kind != op->kind) {
+    i++;
+  }
+  if (i < ops->len) {
+    g_array_index(ops, edit_op_t, i) = *op;
+  } else {
+    g_array_append_val(ops, *op);
+  }
+
+  // a new change drops the redo steps
+  g_ptr_array_set_size(stack->history, stack->position + 1);
+  if (merge) {
+    g_ptr_array_remove_index(stack->history, stack->position);
+    stack->position--;
+  }
+  g_ptr_array_add(stack->history, ops);
+  stack->position++;
+  stack->lastKind = op->kind;
+  stack->lastChange = now;
+}
+
+gboolean edit_stack_is_empty(edit_stack_t* stack) {
+  return get_current_ops(stack)->len == 0;
+}
+
+gboolean edit_stack_undo(edit_stack_t* stack) {
+  if (stack->position == 0) {
+    return FALSE;
+  }
+  stack->position--;
+  stack->lastChange = 0;
+  return TRUE;
+}
+
+gboolean edit_stack_redo(edit_stack_t* stack) {
+  if (stack->position + 1 >= stack->history->len) {
+    return FALSE;
+  }
+  stack->position++;
+  stack->lastChange = 0;
+  return TRUE;
+}
+
+/*
+ * Returns a new reference to the edited source. Cached node outputs are reused
+ * up to the first operation that differs, only the operations after it run again.
+ */
+cairo_surface_t* edit_stack_render(edit_stack_t* stack) {
+  GArray* ops = get_current_ops(stack);
+  cairo_surface_t* input = stack->source;
+  for (guint i = 0; i < ops->len; i++) {
+    edit_op_t* op = &g_array_index(ops, edit_op_t, i);
+    edit_node_t* node = i < stack->nodes->len ? g_ptr_array_index(stack->nodes, i) : NULL;
+    if (NULL == node || !ops_equal(&node->op, op)) {
+      // everything downstream was computed from a different input
+      g_ptr_array_set_size(stack->nodes, i);
+      node = (edit_node_t*)g_malloc0(sizeof(edit_node_t));
+      node->op = *op;
+      node->output = apply_op(input, op, 1.0);
+      memory_budget_charge(MEMORY_POOL_PREVIEWS, memory_get_surface_bytes(node->output));
+      g_ptr_array_add(stack->nodes, node);
+    }
+    input = node->output;
+  }
+  return cairo_surface_reference(input);
+}
+
+/* drops the cached node outputs, the next render runs every operation again */
+void edit_stack_drop_cache(edit_stack_t* stack) {
+  g_ptr_array_set_size(stack->nodes, 0);
+}
+
+/* runs the operations on another version of the source, e.g. a full resolution decode for output, without caching */
+cairo_surface_t* edit_stack_apply(edit_stack_t* stack, cairo_surface_t* source) {
+  GArray* ops = get_current_ops(stack);
+  double scale = (double)cairo_image_surface_get_width(source) / cairo_image_surface_get_width(stack->source);
+  cairo_surface_t* input = cairo_surface_reference(source);
+  for (guint i = 0; i < ops->len; i++) {
+    cairo_surface_t* output = apply_op(input, &g_array_index(ops, edit_op_t, i), scale);
+    cairo_surface_destroy(input);
+    input = output;
+  }
+  return input;
+}
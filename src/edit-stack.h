@@ -0,0 +1,38 @@
+#ifndef EDIT_STACK_H
+#define EDIT_STACK_H
+
+#include <gtk/gtk.h>
+
+#include "effects.h"
+
+typedef enum {
+  EDIT_CROP,
+  EDIT_ROTATE,
+  EDIT_EFFECTS
+} edit_kind_t;
+
+typedef struct {
+  edit_kind_t kind;
+  double cropX; // crop rectangle as fractions of the input, so it fits any resolution
+  double cropY;
+  double cropWidth;
+  double cropHeight;
+  int quarterTurns; // clockwise
+  effect_params_t effects; // redEye in pixels of the operation input, at the resolution of the stack source
+} edit_op_t;
+
+typedef struct edit_stack edit_stack_t;
+
+edit_stack_t* edit_stack_new(cairo_surface_t* source);
+void edit_stack_free(edit_stack_t* stack);
+edit_stack_t* edit_stack_copy(edit_stack_t* stack);
+gboolean edit_stack_get_op(edit_stack_t* stack, edit_kind_t kind, edit_op_t* op);
+void edit_stack_set_op(edit_stack_t* stack, edit_op_t* op);
+gboolean edit_stack_is_empty(edit_stack_t* stack);
+gboolean edit_stack_undo(edit_stack_t* stack);
+gboolean edit_stack_redo(edit_stack_t* stack);
+cairo_surface_t* edit_stack_render(edit_stack_t* stack);
+void edit_stack_drop_cache(edit_stack_t* stack);
+cairo_surface_t* edit_stack_apply(edit_stack_t* stack, cairo_surface_t* source);
+
+#endif
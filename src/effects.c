@@ -0,0 +1,456 @@
+#include <math.h>
+#include <string.h>
+
+#include "effects.h"
+#include "bands.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define EFFECTS_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define EFFECTS_AVX2 1
+#define EFFECTS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define EFFECTS_MIN_BAND_ROWS 32
+#define EFFECTS_LEVELS_CLIP 0.005 // share of pixels ignored at both ends by auto-levels
+#define EFFECTS_MATRIX_SHIFT 7 // color matrix coefficients are fixed point with 7 fractional bits
+
+typedef struct {
+  guint8 r[256];
+  guint8 g[256];
+  guint8 b[256];
+} effect_lut_t;
+
+/* rows are the output B, G, R channels, columns the input B, G, R channels */
+typedef struct {
+  gint16 m[3][3];
+} effect_matrix_t;
+
+typedef struct {
+  guint8* src;
+  guint8* dst;
+  int srcStride;
+  int dstStride;
+  int width;
+  int height;
+  effect_lut_t* lut;
+  effect_matrix_t* matrix;
+  gint16 sharpen; // unsharp mask coefficient, see sharpen_row_scalar
+  GMutex histogramMutex;
+  guint64 histogram[3][256];
+} effect_job_t;
+
+/* ------------------------------------------------------------------------- */
+/* row bands                                                                  */
+
+static void run_bands(effect_job_t* job, int rows, void(*func)(effect_job_t* job, int firstRow, int lastRow)) {
+  bands_run(job, rows, EFFECTS_MIN_BAND_ROWS, (band_func_t)func);
+}
+
+/* ------------------------------------------------------------------------- */
+/* lookup table: levels, brightness, contrast                                 */
+
+static void lut_band(effect_job_t* job, int firstRow, int lastRow) {
+  effect_lut_t* lut = job->lut;
+  for (int y = firstRow; y < lastRow; y++) {
+    guint32* src = (guint32*)(job->src + y * job->srcStride);
+    guint32* dst = (guint32*)(job->dst + y * job->dstStride);
+    for (int x = 0; x < job->width; x++) {
+      guint32 p = src[x];
+      dst[x] = (p & 0xff000000)
+        | (guint32)lut->r[(p >> 16) & 0xff] << 16
+        | (guint32)lut->g[(p >> 8) & 0xff] << 8
+        | lut->b[p & 0xff];
+    }
+  }
+}
+
+static void histogram_band(effect_job_t* job, int firstRow, int lastRow) {
+  guint64 (*histogram)[256] = g_malloc0(sizeof(guint64) * 3 * 256);
+  for (int y = firstRow; y < lastRow; y++) {
+    guint32* src = (guint32*)(job->src + y * job->srcStride);
+    for (int x = 0; x < job->width; x++) {
+      guint32 p = src[x];
+      histogram[0][(p >> 16) & 0xff]++;
+      histogram[1][(p >> 8) & 0xff]++;
+      histogram[2][p & 0xff]++;
+    }
+  }
+  g_mutex_lock(&job->histogramMutex);
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 256; v++) {
+      job->histogram[c][v] += histogram[c][v];
+    }
+  }
+  g_mutex_unlock(&job->histogramMutex);
+  g_free(histogram);
+}
+
+static void get_levels(guint64* histogram, guint64 total, int* low, int* high) {
+  guint64 clip = (guint64)(total * EFFECTS_LEVELS_CLIP);
+  guint64 sum = 0;
+  *low = 0;
+  *high = 255;
+  for (int v = 0; v < 256; v++) {
+    sum += histogram[v];
+    if (sum > clip) {
+      *low = v;
+      break;
+    }
+  }
+  sum = 0;
+  for (int v = 255; v >= 0; v--) {
+    sum += histogram[v];
+    if (sum > clip) {
+      *high = v;
+      break;
+    }
+  }
+  if (*high <= *low) {
+    *low = 0;
+    *high = 255;
+  }
+}
+
+static void build_channel_lut(guint8* table, effect_params_t* params, int low, int high) {
+  double contrast = params->contrast >= 0 ? 1.0 / (1.0 - params->contrast * 0.99) : 1.0 + params->contrast;
+  for (int v = 0; v < 256; v++) {
+    double x = (double)(v - low) / (high - low);
+    x = (x - 0.5) * contrast + 0.5 + params->brightness;
+    table[v] = (guint8)CLAMP((int)(x * 255 + 0.5), 0, 255);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* color matrix: grayscale and sepia                                          */
+
+static void matrix_row_scalar(guint32* row, int count, effect_matrix_t* matrix) {
+  for (int x = 0; x < count; x++) {
+    guint32 p = row[x];
+    int b = p & 0xff, g = (p >> 8) & 0xff, r = (p >> 16) & 0xff;
+    int nb = (matrix->m[0][0] * b + matrix->m[0][1] * g + matrix->m[0][2] * r) >> EFFECTS_MATRIX_SHIFT;
+    int ng = (matrix->m[1][0] * b + matrix->m[1][1] * g + matrix->m[1][2] * r) >> EFFECTS_MATRIX_SHIFT;
+    int nr = (matrix->m[2][0] * b + matrix->m[2][1] * g + matrix->m[2][2] * r) >> EFFECTS_MATRIX_SHIFT;
+    row[x] = (p & 0xff000000) | (guint32)MIN(nr, 255) << 16 | (guint32)MIN(ng, 255) << 8 | (guint32)MIN(nb, 255);
+  }
+}
+
+#ifdef EFFECTS_SSE2
+/* two pixels per register as 16 bit lanes B G R A, each channel is broadcast within its pixel */
+static int matrix_row_sse2(guint32* row, int count, effect_matrix_t* matrix) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i coefB = _mm_setr_epi16(matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0, matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0);
+  const __m128i coefG = _mm_setr_epi16(matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0, matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0);
+  const __m128i coefR = _mm_setr_epi16(matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0, matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0);
+  const __m128i coefA = _mm_setr_epi16(0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT, 0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT);
+  int x = 0;
+  for (; x + 4 <= count; x += 4) {
+    __m128i pixels = _mm_loadu_si128((__m128i*)(row + x));
+    __m128i halves[2] = { _mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero) };
+    for (int i = 0; i < 2; i++) {
+      __m128i v = halves[i];
+      __m128i b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x00), 0x00);
+      __m128i g = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x55), 0x55);
+      __m128i r = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xAA), 0xAA);
+      __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+      __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(b, coefB), _mm_mullo_epi16(g, coefG)),
+                                  _mm_add_epi16(_mm_mullo_epi16(r, coefR), _mm_mullo_epi16(a, coefA)));
+      halves[i] = _mm_srli_epi16(sum, EFFECTS_MATRIX_SHIFT);
+    }
+    _mm_storeu_si128((__m128i*)(row + x), _mm_packus_epi16(halves[0], halves[1]));
+  }
+  return x;
+}
+#endif
+
+#ifdef EFFECTS_AVX2
+EFFECTS_TARGET_AVX2
+static int matrix_row_avx2(guint32* row, int count, effect_matrix_t* matrix) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i coefB = _mm256_setr_epi16(matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0, matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0,
+                                          matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0, matrix->m[0][0], matrix->m[1][0], matrix->m[2][0], 0);
+  const __m256i coefG = _mm256_setr_epi16(matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0, matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0,
+                                          matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0, matrix->m[0][1], matrix->m[1][1], matrix->m[2][1], 0);
+  const __m256i coefR = _mm256_setr_epi16(matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0, matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0,
+                                          matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0, matrix->m[0][2], matrix->m[1][2], matrix->m[2][2], 0);
+  const __m256i coefA = _mm256_setr_epi16(0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT, 0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT,
+                                          0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT, 0, 0, 0, 1 << EFFECTS_MATRIX_SHIFT);
+  int x = 0;
+  for (; x + 8 <= count; x += 8) {
+    // unpack and pack work per 128 bit lane, so the pixel order survives the round trip
+    __m256i pixels = _mm256_loadu_si256((__m256i*)(row + x));
+    __m256i halves[2] = { _mm256_unpacklo_epi8(pixels, zero), _mm256_unpackhi_epi8(pixels, zero) };
+    for (int i = 0; i < 2; i++) {
+      __m256i v = halves[i];
+      __m256i b = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0x00), 0x00);
+      __m256i g = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0x55), 0x55);
+      __m256i r = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xAA), 0xAA);
+      __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xFF), 0xFF);
+      __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(b, coefB), _mm256_mullo_epi16(g, coefG)),
+                                     _mm256_add_epi16(_mm256_mullo_epi16(r, coefR), _mm256_mullo_epi16(a, coefA)));
+      halves[i] = _mm256_srli_epi16(sum, EFFECTS_MATRIX_SHIFT);
+    }
+    _mm256_storeu_si256((__m256i*)(row + x), _mm256_packus_epi16(halves[0], halves[1]));
+  }
+  return x;
+}
+#endif
+
+static gboolean has_avx2() {
+#ifdef EFFECTS_AVX2
+  static int supported = -1;
+  if (supported < 0) {
+    __builtin_cpu_init();
+    supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return supported;
+#else
+  return FALSE;
+#endif
+}
+
+static void matrix_band(effect_job_t* job, int firstRow, int lastRow) {
+  for (int y = firstRow; y < lastRow; y++) {
+    guint32* row = (guint32*)(job->dst + y * job->dstStride);
+    int done = 0;
+#ifdef EFFECTS_AVX2
+    if (has_avx2()) {
+      done = matrix_row_avx2(row, job->width, job->matrix);
+    }
+#endif
+#ifdef EFFECTS_SSE2
+    done += matrix_row_sse2(row + done, job->width - done, job->matrix);
+#endif
+    matrix_row_scalar(row + done, job->width - done, job->matrix);
+  }
+}
+
+static void set_matrix(effect_matrix_t* matrix, double m[3][3]) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      matrix->m[i][j] = (gint16)(m[i][j] * (1 << EFFECTS_MATRIX_SHIFT) + 0.5);
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* sharpen: unsharp mask against a 3x3 box blur                               */
+
+/* out = p + (9p - sum of the 3x3 neighbourhood) * amount / 9, with coef = amount * 65536 / 72 */
+static void sharpen_row_scalar(guint8* above, guint8* row, guint8* below, guint8* out, int first, int last, gint16 coef) {
+  for (int x = first; x < last; x++) {
+    for (int c = 0; c < 3; c++) {
+      int i = x * 4 + c;
+      int sum = above[i - 4] + above[i] + above[i + 4]
+              + row[i - 4] + row[i] + row[i + 4]
+              + below[i - 4] + below[i] + below[i + 4];
+      int diff = row[i] * 9 - sum;
+      out[i] = (guint8)CLAMP(row[i] + ((diff * 8 * coef) >> 16), 0, 255);
+    }
+    out[x * 4 + 3] = row[x * 4 + 3];
+  }
+}
+
+#ifdef EFFECTS_SSE2
+static __m128i sharpen_sum_sse2(guint8* line, __m128i zero, __m128i* lo, __m128i* hi) {
+  __m128i left = _mm_loadu_si128((__m128i*)(line - 4));
+  __m128i center = _mm_loadu_si128((__m128i*)line);
+  __m128i right = _mm_loadu_si128((__m128i*)(line + 4));
+  *lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(center, zero)), _mm_unpacklo_epi8(right, zero));
+  *hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(center, zero)), _mm_unpackhi_epi8(right, zero));
+  return center;
+}
+
+static int sharpen_row_sse2(guint8* above, guint8* row, guint8* below, guint8* out, int first, int last, gint16 coef) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i coefs = _mm_setr_epi16(coef, coef, coef, 0, coef, coef, coef, 0);
+  const __m128i nine = _mm_set1_epi16(9);
+  int x = first;
+  for (; x + 4 <= last; x += 4) {
+    __m128i aLo, aHi, rLo, rHi, bLo, bHi;
+    sharpen_sum_sse2(above + x * 4, zero, &aLo, &aHi);
+    __m128i center = sharpen_sum_sse2(row + x * 4, zero, &rLo, &rHi);
+    sharpen_sum_sse2(below + x * 4, zero, &bLo, &bHi);
+    __m128i cLo = _mm_unpacklo_epi8(center, zero);
+    __m128i cHi = _mm_unpackhi_epi8(center, zero);
+    __m128i diffLo = _mm_sub_epi16(_mm_mullo_epi16(cLo, nine), _mm_add_epi16(_mm_add_epi16(aLo, rLo), bLo));
+    __m128i diffHi = _mm_sub_epi16(_mm_mullo_epi16(cHi, nine), _mm_add_epi16(_mm_add_epi16(aHi, rHi), bHi));
+    __m128i outLo = _mm_add_epi16(cLo, _mm_mulhi_epi16(_mm_slli_epi16(diffLo, 3), coefs));
+    __m128i outHi = _mm_add_epi16(cHi, _mm_mulhi_epi16(_mm_slli_epi16(diffHi, 3), coefs));
+    _mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(outLo, outHi));
+  }
+  return x;
+}
+#endif
+
+#ifdef EFFECTS_AVX2
+EFFECTS_TARGET_AVX2
+static __m256i sharpen_sum_avx2(guint8* line, __m256i zero, __m256i* lo, __m256i* hi) {
+  __m256i left = _mm256_loadu_si256((__m256i*)(line - 4));
+  __m256i center = _mm256_loadu_si256((__m256i*)line);
+  __m256i right = _mm256_loadu_si256((__m256i*)(line + 4));
+  *lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(left, zero), _mm256_unpacklo_epi8(center, zero)), _mm256_unpacklo_epi8(right, zero));
+  *hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(left, zero), _mm256_unpackhi_epi8(center, zero)), _mm256_unpackhi_epi8(right, zero));
+  return center;
+}
+
+EFFECTS_TARGET_AVX2
+static int sharpen_row_avx2(guint8* above, guint8* row, guint8* below, guint8* out, int first, int last, gint16 coef) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i coefs = _mm256_setr_epi16(coef, coef, coef, 0, coef, coef, coef, 0, coef, coef, coef, 0, coef, coef, coef, 0);
+  const __m256i nine = _mm256_set1_epi16(9);
+  int x = first;
+  for (; x + 8 <= last; x += 8) {
+    __m256i aLo, aHi, rLo, rHi, bLo, bHi;
+    sharpen_sum_avx2(above + x * 4, zero, &aLo, &aHi);
+    __m256i center = sharpen_sum_avx2(row + x * 4, zero, &rLo, &rHi);
+    sharpen_sum_avx2(below + x * 4, zero, &bLo, &bHi);
+    __m256i cLo = _mm256_unpacklo_epi8(center, zero);
+    __m256i cHi = _mm256_unpackhi_epi8(center, zero);
+    __m256i diffLo = _mm256_sub_epi16(_mm256_mullo_epi16(cLo, nine), _mm256_add_epi16(_mm256_add_epi16(aLo, rLo), bLo));
+    __m256i diffHi = _mm256_sub_epi16(_mm256_mullo_epi16(cHi, nine), _mm256_add_epi16(_mm256_add_epi16(aHi, rHi), bHi));
+    __m256i outLo = _mm256_add_epi16(cLo, _mm256_mulhi_epi16(_mm256_slli_epi16(diffLo, 3), coefs));
+    __m256i outHi = _mm256_add_epi16(cHi, _mm256_mulhi_epi16(_mm256_slli_epi16(diffHi, 3), coefs));
+    _mm256_storeu_si256((__m256i*)(out + x * 4), _mm256_packus_epi16(outLo, outHi));
+  }
+  return x;
+}
+#endif
+
+/* reads job->src and writes job->dst, border pixels are copied unchanged */
+static void sharpen_band(effect_job_t* job, int firstRow, int lastRow) {
+  for (int y = firstRow; y < lastRow; y++) {
+    guint8* row = job->src + y * job->srcStride;
+    guint8* out = job->dst + y * job->dstStride;
+    memcpy(out, row, job->width * 4);
+    if (y == 0 || y == job->height - 1 || job->width < 3) {
+      continue;
+    }
+    guint8* above = row - job->srcStride;
+    guint8* below = row + job->srcStride;
+    int x = 1;
+#ifdef EFFECTS_AVX2
+    if (has_avx2()) {
+      x = sharpen_row_avx2(above, row, below, out, x, job->width - 1, job->sharpen);
+    }
+#endif
+#ifdef EFFECTS_SSE2
+    x = sharpen_row_sse2(above, row, below, out, x, job->width - 1, job->sharpen);
+#endif
+    sharpen_row_scalar(above, row, below, out, x, job->width - 1, job->sharpen);
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+/* red-eye                                                                    */
+
+static void correct_red_eye(guint8* data, int stride, int width, int height, cairo_rectangle_int_t* region) {
+  int x0 = CLAMP(region->x, 0, width), x1 = CLAMP(region->x + region->width, 0, width);
+  int y0 = CLAMP(region->y, 0, height), y1 = CLAMP(region->y + region->height, 0, height);
+  for (int y = y0; y < y1; y++) {
+    guint32* row = (guint32*)(data + y * stride);
+    for (int x = x0; x < x1; x++) {
+      guint32 p = row[x];
+      int b = p & 0xff, g = (p >> 8) & 0xff, r = (p >> 16) & 0xff;
+      int average = (g + b) / 2;
+      if (r > 60 && r - average > 40) {
+        row[x] = (p & 0xff00ffff) | (guint32)average << 16;
+      }
+    }
+  }
+}
+
+/* ------------------------------------------------------------------------- */
+
+void effects_init_params(effect_params_t* params) {
+  memset(params, 0, sizeof(effect_params_t));
+}
+
+gboolean effects_are_identity(effect_params_t* params) {
+  return params->brightness == 0 && params->contrast == 0 && !params->grayscale && !params->sepia
+    && !params->autoLevels && params->sharpen <= 0 && (params->redEye.width <= 0 || params->redEye.height <= 0);
+}
+
+static cairo_surface_t* create_like(cairo_surface_t* source) {
+  cairo_format_t format = cairo_image_surface_get_format(source) == CAIRO_FORMAT_ARGB32 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+  return cairo_image_surface_create(format, cairo_image_surface_get_width(source), cairo_image_surface_get_height(source));
+}
+
+/*
+ * Returns a new surface with the effects applied, the source is not modified.
+ * Work is split into row bands over all cores, using SSE2/AVX2 where available.
+ */
+cairo_surface_t* effects_apply(cairo_surface_t* source, effect_params_t* params) {
+  cairo_surface_t* input = source;
+  cairo_format_t format = cairo_image_surface_get_format(source);
+  if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24) {
+    input = cairo_image_surface_create(CAIRO_FORMAT_RGB24, cairo_image_surface_get_width(source), cairo_image_surface_get_height(source));
+    cairo_t* cr = cairo_create(input);
+    cairo_set_source_surface(cr, source, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+  } else {
+    cairo_surface_reference(input);
+  }
+  cairo_surface_flush(input);
+
+  cairo_surface_t* result = create_like(input);
+  effect_job_t job;
+  memset(&job, 0, sizeof(job));
+  g_mutex_init(&job.histogramMutex);
+  job.width = cairo_image_surface_get_width(input);
+  job.height = cairo_image_surface_get_height(input);
+  job.src = cairo_image_surface_get_data(input);
+  job.srcStride = cairo_image_surface_get_stride(input);
+  job.dst = cairo_image_surface_get_data(result);
+  job.dstStride = cairo_image_surface_get_stride(result);
+
+  int low[3] = { 0, 0, 0 }, high[3] = { 255, 255, 255 };
+  if (params->autoLevels) {
+    run_bands(&job, job.height, histogram_band);
+    for (int c = 0; c < 3; c++) {
+      get_levels(job.histogram[c], (guint64)job.width * job.height, &low[c], &high[c]);
+    }
+  }
+  effect_lut_t lut;
+  build_channel_lut(lut.r, params, low[0], high[0]);
+  build_channel_lut(lut.g, params, low[1], high[1]);
+  build_channel_lut(lut.b, params, low[2], high[2]);
+  job.lut = &lut;
+  run_bands(&job, job.height, lut_band);
+
+  if (params->redEye.width > 0 && params->redEye.height > 0) {
+    correct_red_eye(job.dst, job.dstStride, job.width, job.height, &params->redEye);
+  }
+
+  if (params->grayscale || params->sepia) {
+    // Rec. 601 luma, and the common sepia tone matrix
+    double gray[3][3] = { { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 }, { 0.114, 0.587, 0.299 } };
+    double sepia[3][3] = { { 0.131, 0.534, 0.272 }, { 0.168, 0.686, 0.349 }, { 0.189, 0.769, 0.393 } };
+    effect_matrix_t matrix;
+    set_matrix(&matrix, params->sepia ? sepia : gray);
+    job.matrix = &matrix;
+    run_bands(&job, job.height, matrix_band);
+  }
+
+  if (params->sharpen > 0) {
+    cairo_surface_t* sharpened = create_like(result);
+    job.src = job.dst;
+    job.srcStride = job.dstStride;
+    job.dst = cairo_image_surface_get_data(sharpened);
+    job.dstStride = cairo_image_surface_get_stride(sharpened);
+    job.sharpen = (gint16)(MIN(params->sharpen, 2.0) * 65536 / 72);
+    run_bands(&job, job.height, sharpen_band);
+    cairo_surface_destroy(result);
+    result = sharpened;
+  }
+
+  g_mutex_clear(&job.histogramMutex);
+  cairo_surface_destroy(input);
+  cairo_surface_mark_dirty(result);
+  return result;
+}
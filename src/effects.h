@@ -0,0 +1,20 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <gtk/gtk.h>
+
+typedef struct {
+  double brightness; // -1 .. 1
+  double contrast; // -1 .. 1
+  gboolean grayscale;
+  gboolean sepia;
+  gboolean autoLevels;
+  double sharpen; // 0 .. 2
+  cairo_rectangle_int_t redEye; // region to correct, empty for none
+} effect_params_t;
+
+void effects_init_params(effect_params_t* params);
+gboolean effects_are_identity(effect_params_t* params);
+cairo_surface_t* effects_apply(cairo_surface_t* source, effect_params_t* params);
+
+#endif
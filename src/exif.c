@@ -0,0 +1,170 @@
+#include <string.h>
+
+#include "exif.h"
+#include "file-map.h"
+#include "loader.h"
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TAG_THUMBNAIL_OFFSET 0x0201
+#define EXIF_TAG_THUMBNAIL_LENGTH 0x0202
+#define EXIF_MAX_PREFIX (256 * 1024) // APP1 segments are at most 64 KB and come first
+
+typedef struct {
+  const guchar* data; // TIFF header start
+  gsize length;
+  gboolean bigEndian;
+} tiff_t;
+
+static guint read_u16(tiff_t* tiff, gsize offset) {
+  const guchar* p = tiff->data + offset;
+  return tiff->bigEndian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+
+static guint32 read_u32(tiff_t* tiff, gsize offset) {
+  const guchar* p = tiff->data + offset;
+  return tiff->bigEndian
+    ? ((guint32)p[0] << 24 | (guint32)p[1] << 16 | (guint32)p[2] << 8 | p[3])
+    : ((guint32)p[3] << 24 | (guint32)p[2] << 16 | (guint32)p[1] << 8 | p[0]);
+}
+
+/* returns the value of a SHORT/LONG tag in the IFD at offset, or def if absent */
+static guint32 read_ifd_tag(tiff_t* tiff, guint32 offset, guint tag, guint32 def) {
+  if (offset >= tiff->length || tiff->length - offset < 2) {
+    return def;
+  }
+  guint count = read_u16(tiff, offset);
+  for (guint i = 0; i < count; i++) {
+    gsize entry = (gsize)offset + 2 + (gsize)i * 12;
+    if (entry > tiff->length || tiff->length - entry < 12) {
+      break;
+    }
+    if (read_u16(tiff, entry) == tag) {
+      return read_u16(tiff, entry + 2) == 3 ? read_u16(tiff, entry + 8) : read_u32(tiff, entry + 8);
+    }
+  }
+  return def;
+}
+
+static guint32 next_ifd(tiff_t* tiff, guint32 offset) {
+  if (offset >= tiff->length || tiff->length - offset < 2) {
+    return 0;
+  }
+  gsize next = (gsize)offset + 2 + (gsize)read_u16(tiff, offset) * 12;
+  return next > tiff->length || tiff->length - next < 4 ? 0 : read_u32(tiff, next);
+}
+
+/* finds the APP1 Exif segment of JPEG data, NULL if there is none */
+static const guchar* find_exif_segment(const guchar* data, gsize length, gsize* segmentLength) {
+  gsize offset = 2;
+  if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    return NULL;
+  }
+  while (offset + 4 <= length && data[offset] == 0xFF) {
+    guint marker = data[offset + 1];
+    gsize size = (data[offset + 2] << 8 | data[offset + 3]);
+    if (size < 2 || marker == 0xDA) {
+      break; // start of scan, no more metadata
+    }
+    size -= 2;
+    offset += 4;
+    if (size > length - offset) {
+      break;
+    }
+    if (marker == 0xE1 && size > 6 && memcmp(data + offset, "Exif\0\0", 6) == 0) {
+      *segmentLength = size;
+      return data + offset;
+    }
+    offset += size;
+  }
+  return NULL;
+}
+
+/* reads the TIFF header of an Exif segment, FALSE if it is not one */
+static gboolean open_tiff(const guchar* segment, gsize length, tiff_t* tiff) {
+  tiff->data = segment + 6;
+  tiff->length = length - 6;
+  if (tiff->length < 8 || (memcmp(tiff->data, "MM", 2) != 0 && memcmp(tiff->data, "II", 2) != 0)) {
+    return FALSE;
+  }
+  tiff->bigEndian = tiff->data[0] == 'M';
+  return TRUE;
+}
+
+/* EXIF orientation of JPEG data, 1 (upright) when there is none */
+int get_exif_orientation(const guchar* data, gsize length) {
+  gsize segmentLength = 0;
+  tiff_t tiff;
+  const guchar* segment = find_exif_segment(data, length, &segmentLength);
+  if (NULL == segment || !open_tiff(segment, segmentLength, &tiff)) {
+    return 1;
+  }
+  return read_ifd_tag(&tiff, read_u32(&tiff, 4), EXIF_TAG_ORIENTATION, 1);
+}
+
+/* same mapping as gdk_pixbuf_apply_embedded_orientation */
+GdkPixbuf* apply_exif_orientation(GdkPixbuf* pixbuf, int orientation) {
+  GdkPixbuf* temp;
+  GdkPixbuf* result;
+  switch (orientation) {
+    case 2: return gdk_pixbuf_flip(pixbuf, TRUE);
+    case 3: return gdk_pixbuf_rotate_simple(pixbuf, GDK_PIXBUF_ROTATE_UPSIDEDOWN);
+    case 4: return gdk_pixbuf_flip(pixbuf, FALSE);
+    case 5:
+      temp = gdk_pixbuf_rotate_simple(pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE);
+      result = gdk_pixbuf_flip(temp, TRUE);
+      g_object_unref(temp);
+      return result;
+    case 6: return gdk_pixbuf_rotate_simple(pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE);
+    case 7:
+      temp = gdk_pixbuf_rotate_simple(pixbuf, GDK_PIXBUF_ROTATE_CLOCKWISE);
+      result = gdk_pixbuf_flip(temp, FALSE);
+      g_object_unref(temp);
+      return result;
+    case 8: return gdk_pixbuf_rotate_simple(pixbuf, GDK_PIXBUF_ROTATE_COUNTERCLOCKWISE);
+    default: return g_object_ref(pixbuf);
+  }
+}
+
+/* 
+ * Decodes the thumbnail embedded in a camera JPEG, oriented like the full image.
+ * Returns NULL when there is none or it is smaller than minSize.
+ */
+GdkPixbuf* load_exif_thumbnail(char* filename, int minSize) {
+  gsize length = 0;
+  gsize fileLength = 0;
+  GdkPixbuf* result = NULL;
+  // the metadata sits at the start, files on sticks are only read that far
+  GBytes* bytes = file_map_get_prefix(filename, EXIF_MAX_PREFIX, NULL);
+  if (NULL == bytes) {
+    return NULL;
+  }
+  const guchar* data = g_bytes_get_data(bytes, &fileLength);
+  const guchar* segment = find_exif_segment(data, fileLength, &length);
+  if (NULL == segment) {
+    g_bytes_unref(bytes);
+    return NULL;
+  }
+  tiff_t tiff;
+  if (!open_tiff(segment, length, &tiff)) {
+    g_bytes_unref(bytes);
+    return NULL;
+  }
+
+  guint32 ifd0 = read_u32(&tiff, 4);
+  guint32 ifd1 = next_ifd(&tiff, ifd0);
+  int orientation = read_ifd_tag(&tiff, ifd0, EXIF_TAG_ORIENTATION, 1);
+  guint32 offset = ifd1 ? read_ifd_tag(&tiff, ifd1, EXIF_TAG_THUMBNAIL_OFFSET, 0) : 0;
+  guint32 size = ifd1 ? read_ifd_tag(&tiff, ifd1, EXIF_TAG_THUMBNAIL_LENGTH, 0) : 0;
+
+  if (offset > 0 && size > 0 && offset < tiff.length && size <= tiff.length - offset) {
+    GdkPixbuf* thumbnail = load_pixbuf_from_data(tiff.data + offset, size, 0, 0, NULL);
+    if (thumbnail && gdk_pixbuf_get_width(thumbnail) >= minSize && gdk_pixbuf_get_height(thumbnail) >= minSize) {
+      result = apply_exif_orientation(thumbnail, orientation);
+    }
+    if (thumbnail) {
+      g_object_unref(thumbnail);
+    }
+  }
+  g_bytes_unref(bytes);
+  return result;
+}
@@ -0,0 +1,6 @@
+#include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+GdkPixbuf* load_exif_thumbnail(char* filename, int minSize);
+GdkPixbuf* apply_exif_orientation(GdkPixbuf* pixbuf, int orientation);
+int get_exif_orientation(const guchar* data, gsize length);
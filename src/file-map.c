@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "file-map.h"
+#include "memory-budget.h"
+
+#define FILE_MAP_MAX_FILES 128
+#define FILE_MAP_MAX_READ_BYTES (128 * 1024 * 1024) // the most recent file is kept even if larger
+
+typedef struct {
+  char* filename;
+  GBytes* bytes; // keeps the GMappedFile alive, or the contents read from a removable device
+  gint64 size;
+  gint64 mtime;
+} file_map_t;
+
+/* files by name in most recently used order */
+typedef struct {
+  GHashTable* files; // filename -> GList link in order
+  GQueue order; // most recently used first
+  gint64 bytes;
+  gboolean charged; // bytes count against the memory budget
+} file_cache_t;
+
+static GMutex mapMutex;
+static file_cache_t mappedFiles = { NULL, G_QUEUE_INIT, 0, FALSE };
+static file_cache_t readFiles = { NULL, G_QUEUE_INIT, 0, TRUE }; // a mapping of a removable device could fault once it is pulled
+static GPtrArray* removableRoots = NULL; // mount points of removable devices, files below them are never mapped
+
+static void free_file_map(file_map_t* map) {
+  g_free(map->filename);
+  g_bytes_unref(map->bytes);
+  g_free(map);
+}
+
+/* called with mapMutex held, readers still holding the bytes keep them alive */
+static void remove_file_map(file_cache_t* cache, GList* link) {
+  file_map_t* map = (file_map_t*)link->data;
+  g_hash_table_remove(cache->files, map->filename);
+  g_queue_delete_link(&cache->order, link);
+  cache->bytes -= map->size;
+  if (cache->charged) {
+    memory_budget_release(MEMORY_POOL_FILES, map->size);
+  }
+  free_file_map(map);
+}
+
+/* a new reference to the cached bytes of filename if they are still current, called with mapMutex held */
+static GBytes* lookup_file_map(file_cache_t* cache, const char* filename, GStatBuf* st) {
+  if (NULL == cache->files) {
+    cache->files = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+  GList* link = g_hash_table_lookup(cache->files, filename);
+  if (NULL == link) {
+    return NULL;
+  }
+  file_map_t* map = (file_map_t*)link->data;
+  if (map->size != st->st_size || map->mtime != st->st_mtime) {
+    remove_file_map(cache, link); // the file changed on disk
+    return NULL;
+  }
+  g_queue_unlink(&cache->order, link);
+  g_queue_push_head_link(&cache->order, link);
+  return g_bytes_ref(map->bytes);
+}
+
+/* adopts bytes, a new reference to what is cached for filename is returned */
+static GBytes* store_file_map(file_cache_t* cache, const char* filename, GStatBuf* st, GBytes* bytes) {
+  file_map_t* map = (file_map_t*)g_malloc0(sizeof(file_map_t));
+  map->filename = g_strdup(filename);
+  map->bytes = bytes;
+  map->size = g_bytes_get_size(bytes);
+  map->mtime = st->st_mtime;
+
+  g_mutex_lock(&mapMutex);
+  GList* link = g_hash_table_lookup(cache->files, filename);
+  if (link) {
+    // stored by another thread meanwhile, every reader shares the first copy
+    free_file_map(map);
+    GBytes* result = g_bytes_ref(((file_map_t*)link->data)->bytes);
+    g_mutex_unlock(&mapMutex);
+    return result;
+  }
+  GBytes* result = g_bytes_ref(map->bytes);
+  g_queue_push_head(&cache->order, map);
+  g_hash_table_insert(cache->files, map->filename, cache->order.head);
+  cache->bytes += map->size;
+  if (cache->charged) {
+    memory_budget_charge(MEMORY_POOL_FILES, map->size);
+  }
+  while (cache->order.length > FILE_MAP_MAX_FILES
+         || (cache->charged && cache->bytes > FILE_MAP_MAX_READ_BYTES && cache->order.length > 1)) {
+    remove_file_map(cache, cache->order.tail);
+  }
+  g_mutex_unlock(&mapMutex);
+  return result;
+}
+
+/* called with mapMutex held */
+static gboolean is_below(const char* filename, const char* root) {
+  gsize length = strlen(root);
+  return strncmp(filename, root, length) == 0 && (filename[length] == '/' || filename[length] == 0 || root[length - 1] == '/');
+}
+
+/* called with mapMutex held */
+static gboolean is_removable(const char* filename) {
+  for (guint i = 0; removableRoots && i < removableRoots->len; i++) {
+    if (is_below(filename, g_ptr_array_index(removableRoots, i))) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* frees the least recently read files, runs on the main thread */
+static void evict_read_files(gint64 bytes, gpointer data) {
+  g_mutex_lock(&mapMutex);
+  gint64 target = readFiles.bytes - bytes;
+  while (readFiles.order.length > 0 && readFiles.bytes > target) {
+    remove_file_map(&readFiles, readFiles.order.tail);
+  }
+  g_mutex_unlock(&mapMutex);
+}
+
+/*
+ * Maps a file once per session and hands out the same read-only mapping to
+ * every loader, so repeated reads come from the page cache. Returns a new
+ * reference. Files on removable devices are read into memory instead, touching
+ * a mapping after the stick is pulled would kill the process. Their contents
+ * are shared the same way while they fit the read cache and the memory budget.
+ */
+GBytes* file_map_get(const char* filename, GError** error) {
+  GStatBuf st;
+  if (g_stat(filename, &st) != 0) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Could not stat %s", filename);
+    return NULL;
+  }
+
+  g_mutex_lock(&mapMutex);
+  file_cache_t* cache = is_removable(filename) ? &readFiles : &mappedFiles;
+  GBytes* cached = lookup_file_map(cache, filename, &st);
+  g_mutex_unlock(&mapMutex);
+  if (cached) {
+    return cached;
+  }
+
+  GBytes* bytes = NULL;
+  if (cache == &readFiles) {
+    gchar* contents;
+    gsize length;
+    if (!g_file_get_contents(filename, &contents, &length, error)) {
+      return NULL;
+    }
+    bytes = g_bytes_new_take(contents, length);
+  } else {
+    GMappedFile* mappedFile = g_mapped_file_new(filename, FALSE, error);
+    if (NULL == mappedFile) {
+      return NULL;
+    }
+    bytes = g_mapped_file_get_bytes(mappedFile);
+    g_mapped_file_unref(mappedFile);
+  }
+  return store_file_map(cache, filename, &st, bytes);
+}
+
+/*
+ * At least the first length bytes of a file, or all of it if it is shorter,
+ * e.g. for headers and EXIF. Comes from the shared mapping or read cache when
+ * the file is there, otherwise files on removable devices are read only that far.
+ */
+GBytes* file_map_get_prefix(const char* filename, gsize length, GError** error) {
+  GStatBuf st;
+  g_mutex_lock(&mapMutex);
+  gboolean removable = is_removable(filename);
+  g_mutex_unlock(&mapMutex);
+  if (!removable) {
+    return file_map_get(filename, error);
+  }
+  if (g_stat(filename, &st) != 0) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Could not stat %s", filename);
+    return NULL;
+  }
+  g_mutex_lock(&mapMutex);
+  GBytes* cached = lookup_file_map(&readFiles, filename, &st);
+  g_mutex_unlock(&mapMutex);
+  if (cached) {
+    return cached;
+  }
+
+  int fd = g_open(filename, O_RDONLY, 0);
+  if (fd < 0) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Could not open %s", filename);
+    return NULL;
+  }
+  gsize wanted = MIN(length, (gsize)st.st_size);
+  guchar* data = g_malloc(MAX(1, wanted));
+  gsize done = 0;
+  while (done < wanted) {
+    ssize_t count = read(fd, data + done, wanted - done);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), "Could not read %s", filename);
+      g_free(data);
+      close(fd);
+      return NULL;
+    }
+    if (count == 0) {
+      break;
+    }
+    done += count;
+  }
+  close(fd);
+  return g_bytes_new_take(data, done);
+}
+
+/* files below root are read instead of mapped from now on */
+void file_map_add_removable_root(const char* root) {
+  g_mutex_lock(&mapMutex);
+  if (NULL == removableRoots) {
+    removableRoots = g_ptr_array_new_with_free_func(g_free);
+    memory_budget_set_evictor(MEMORY_POOL_FILES, evict_read_files, NULL);
+  }
+  g_ptr_array_add(removableRoots, g_strdup(root));
+  g_mutex_unlock(&mapMutex);
+}
+
+/* the device at root is gone, what was read or mapped from it is dropped */
+void file_map_remove_removable_root(const char* root) {
+  g_mutex_lock(&mapMutex);
+  for (guint i = 0; removableRoots && i < removableRoots->len; i++) {
+    if (g_str_equal(g_ptr_array_index(removableRoots, i), root)) {
+      g_ptr_array_remove_index(removableRoots, i);
+      break;
+    }
+  }
+  file_cache_t* caches[] = { &readFiles, &mappedFiles };
+  for (int i = 0; i < G_N_ELEMENTS(caches); i++) {
+    GList* link = caches[i]->order.head;
+    while (link) {
+      GList* next = link->next;
+      if (is_below(((file_map_t*)link->data)->filename, root)) {
+        remove_file_map(caches[i], link);
+      }
+      link = next;
+    }
+  }
+  g_mutex_unlock(&mapMutex);
+}
@@ -0,0 +1,7 @@
+#include <glib.h>
+
+GBytes* file_map_get(const char* filename, GError** error);
+GBytes* file_map_get_prefix(const char* filename, gsize length, GError** error);
+void file_map_add_removable_root(const char* root);
+void file_map_remove_removable_root(const char* root);
+
@@ -5,34 +5,76 @@
 #define FILE_ITEM_STATE_CLICK 2
 #define FILE_ITEM_STATE_SELECTED 3
 
+#define FILE_ENTRY_THUMBNAIL_NONE 0
+#define FILE_ENTRY_THUMBNAIL_PENDING 1
+#define FILE_ENTRY_THUMBNAIL_FAILED 2
+
 const int icon_width = 128;
 const int icon_height = 128;
 
-const int icon_image_width = 122;
-const int icon_image_height = 122;
+const int icon_image_width = THUMBNAIL_SIZE;
+const int icon_image_height = THUMBNAIL_SIZE;
+
+const int icon_spacing = 4;
+const int grid_margin_items = 8; // tiles kept bound left and right of the viewport
+
+typedef void(*file_item_callback_t)(GtkWidget*, GdkEvent*, gpointer);
+
+/* one directory entry, tiles are only created for the visible ones. Strings live in the grid's string chunk. */
+typedef struct {
+  char* iconPath; // fixed icon, NULL for thumbnails
+  char* filePath;
+  gint64 size; // as listed, together with mtime the key of the thumbnail memory cache
+  gint64 mtime;
+  thumbnail_kind_t kind;
+  int thumbnailState;
+  char* tooltip;
+  void(*callback)(void);
+  gpointer user_data;
+} file_entry_t;
 
 typedef struct {
-  GtkImage* image;
+  GtkLayout* layout;
+  GtkAdjustment* adjustment;
+  GArray* entries; // file_entry_t
+  GStringChunk* strings; // entry metadata of the current folder, freed at once by clear_file_items
+  GPtrArray* items; // recycled tiles
+  GHashTable* icons; // icon path -> GdkPixbuf
+} file_grid_t;
+
+typedef struct {
+  GtkWidget* area;
+  file_grid_t* grid;
+  GdkPixbuf* pixbuf;
+  int index; // bound entry, -1 when unused
   int state;
   int width;
   int height;
 } file_item_t;
 
+static void update_file_grid(file_grid_t* grid);
+
 static gboolean
 draw_callback (GtkWidget *widget, cairo_t *cr, gpointer data)
 {
   file_item_t* item = (file_item_t*)data;
-  g_assert(item); g_assert(item->image);
-  GdkPixbuf* pixBuf = gtk_image_get_pixbuf(item->image);
-  gdk_cairo_set_source_pixbuf(cr, pixBuf, icon_width/2 - icon_image_width/2, icon_height/2 - icon_image_height/2);
+  g_assert(item);
+  if (NULL == item->pixbuf) {
+    // thumbnail still loading
+    cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+    cairo_rectangle(cr, icon_width/2 - icon_image_width/2, icon_height/2 - icon_image_height/2, icon_image_width, icon_image_height);
+    cairo_fill(cr);
+    return FALSE;
+  }
+  gdk_cairo_set_source_pixbuf(cr, item->pixbuf, icon_width/2 - icon_image_width/2, icon_height/2 - icon_image_height/2);
   cairo_rectangle(cr, 0, 0, item->width, item->height);
   if (item->state == FILE_ITEM_STATE_NONE) {
      cairo_paint_with_alpha(cr, 0.7);
      return FALSE;
   }
-  
+
   cairo_paint(cr);
-  
+
   return FALSE;
 }
 
@@ -40,6 +82,7 @@ static void hover_image( GtkWidget *widget, GdkEvent* ev, file_item_t* item) {
   GdkCursor* cursor = gdk_cursor_new(GDK_HAND1);
   item->state = FILE_ITEM_STATE_HOVER;
   gdk_window_set_cursor (gtk_widget_get_parent_window(widget), cursor);
+  g_object_unref(cursor);
   gtk_widget_queue_draw(widget);
 }
 
@@ -55,91 +98,285 @@ static void click_image( GtkWidget *widget, GdkEvent* ev, file_item_t* item) {
   gtk_widget_queue_draw(widget);
 }
 
+static gboolean release_image( GtkWidget *widget, GdkEvent* ev, file_item_t* item) {
+  if (item->index < 0) {
+    return FALSE;
+  }
+  // the callback may clear the grid, so do not touch the entry afterwards
+  file_entry_t* entry = &g_array_index(item->grid->entries, file_entry_t, item->index);
+  ((file_item_callback_t)entry->callback)(widget, ev, entry->user_data);
+  return FALSE;
+}
+
 static void icon_destroy( GtkWidget *widget, file_item_t* item) {
-  g_print("Destroy\n");
-  g_object_ref_sink(item->image);
-  gtk_widget_destroy(item->image);
+  if (item->pixbuf) {
+    g_object_unref(item->pixbuf);
+  }
   g_free(item);
 }
 
-static GtkImage* create_item_icon(char* filepath) {
-  GdkPixbuf * pixBuf = gdk_pixbuf_new_from_file (filepath, NULL);
-  GdkPixbuf * imgBuf = gdk_pixbuf_scale_simple(pixBuf, icon_image_width, icon_image_height, GDK_INTERP_BILINEAR);
-  GtkImage* result = gtk_image_new_from_pixbuf(imgBuf);
-  g_object_unref(pixBuf);
-  g_object_unref(imgBuf);
-  return result;
+static void free_file_grid(file_grid_t* grid) {
+  g_array_free(grid->entries, TRUE);
+  g_string_chunk_free(grid->strings);
+  g_ptr_array_free(grid->items, TRUE);
+  g_hash_table_destroy(grid->icons);
+  g_free(grid);
+}
+
+static file_grid_t* get_file_grid_data(GtkContainer* container) {
+  file_grid_t* grid = (file_grid_t*)g_object_get_data(G_OBJECT(container), "file-grid");
+  g_assert(grid);
+  return grid;
 }
 
-static void add_file_item_image(GtkContainer* container, GtkImage* icon, char* tooltip, void(*callback)(void), gpointer user_data) {
-  g_assert(container); g_assert(icon);
-  
+static GdkPixbuf* get_icon(file_grid_t* grid, char* imagePath) {
+  GdkPixbuf* icon = g_hash_table_lookup(grid->icons, imagePath);
+  if (NULL == icon) {
+    GdkPixbuf* pixBuf = gdk_pixbuf_new_from_file (imagePath, NULL);
+    if (NULL == pixBuf) {
+      return NULL;
+    }
+    icon = gdk_pixbuf_scale_simple(pixBuf, icon_image_width, icon_image_height, GDK_INTERP_BILINEAR);
+    g_object_unref(pixBuf);
+    g_hash_table_insert(grid->icons, g_strdup(imagePath), icon);
+  }
+  return icon;
+}
+
+static void set_item_pixbuf(file_item_t* item, GdkPixbuf* pixbuf) {
+  if (item->pixbuf) {
+    g_object_unref(item->pixbuf);
+  }
+  item->pixbuf = pixbuf ? g_object_ref(pixbuf) : NULL;
+  gtk_widget_queue_draw(item->area);
+}
+
+static void on_item_thumbnail(GdkPixbuf* pixbuf, int index, file_grid_t* grid) {
+  file_entry_t* entry = &g_array_index(grid->entries, file_entry_t, index);
+  entry->thumbnailState = pixbuf ? FILE_ENTRY_THUMBNAIL_NONE : FILE_ENTRY_THUMBNAIL_FAILED;
+  // the pixbuf stays in the thumbnail cache, only a bound tile keeps a reference
+  for (guint i = 0; i < grid->items->len; i++) {
+    file_item_t* item = g_ptr_array_index(grid->items, i);
+    if (item->index == index) {
+      set_item_pixbuf(item, pixbuf ? pixbuf : get_icon(grid, "assets/error.png"));
+    }
+  }
+}
+
+static file_item_t* create_item(file_grid_t* grid) {
   GtkDrawingArea* area = gtk_drawing_area_new();
   gtk_widget_add_events (area, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK | GDK_ENTER_NOTIFY_MASK | GDK_LEAVE_NOTIFY_MASK);
-  file_item_t* item = (file_item_t*)g_malloc(sizeof(file_item_t));
-  
+  file_item_t* item = (file_item_t*)g_malloc0(sizeof(file_item_t));
+
+  item->area = area;
+  item->grid = grid;
+  item->index = -1;
   item->width = icon_width;
   item->height = icon_height;
-  item->image = icon;
   item->state = FILE_ITEM_STATE_NONE;
-  
-  gtk_widget_set_size_request(area, item->width, item->height);
 
-  gtk_widget_set_tooltip_text(area, tooltip); 
+  gtk_widget_set_size_request(area, item->width, item->height);
 
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "destroy",
-    G_CALLBACK(icon_destroy), 
+    G_CALLBACK(icon_destroy),
     item
   );
 
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "button_release_event",
-    G_CALLBACK(callback), 
-    user_data
+    G_CALLBACK(release_image),
+    item
   );
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "button_press_event",
-    G_CALLBACK(click_image), 
+    G_CALLBACK(click_image),
     item
   );
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "enter-notify-event",
     G_CALLBACK(hover_image),
     item
   );
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "leave-notify-event",
     G_CALLBACK(unhover_image),
     item
   );
   g_signal_connect (
-    G_OBJECT(area), 
+    G_OBJECT(area),
     "draw",
     G_CALLBACK(draw_callback),
     item
   );
-  gtk_container_add(container, area);
-  gtk_widget_show_all(area);
+  gtk_layout_put(grid->layout, area, 0, 0);
+  g_ptr_array_add(grid->items, item);
+  return item;
+}
+
+static void bind_item(file_item_t* item, int index) {
+  file_grid_t* grid = item->grid;
+  file_entry_t* entry = &g_array_index(grid->entries, file_entry_t, index);
+
+  item->index = index;
+  item->state = FILE_ITEM_STATE_NONE;
+  gtk_widget_set_tooltip_text(item->area, entry->tooltip);
+  gtk_layout_move(grid->layout, item->area, index * (icon_width + icon_spacing), 0);
+  gtk_widget_show(item->area);
+
+  if (entry->iconPath) {
+    set_item_pixbuf(item, get_icon(grid, entry->iconPath));
+    return;
+  }
+  if (entry->thumbnailState == FILE_ENTRY_THUMBNAIL_FAILED) {
+    set_item_pixbuf(item, get_icon(grid, "assets/error.png"));
+    return;
+  }
+  set_item_pixbuf(item, NULL);
+  if (entry->thumbnailState == FILE_ENTRY_THUMBNAIL_NONE) {
+    // a memory cache hit calls on_item_thumbnail right away
+    entry->thumbnailState = FILE_ENTRY_THUMBNAIL_PENDING;
+    thumbnail_request(entry->filePath, entry->size, entry->mtime, entry->kind, index, (thumbnail_callback_t)on_item_thumbnail, grid);
+  }
+}
+
+static void unbind_item(file_item_t* item) {
+  item->index = -1;
+  set_item_pixbuf(item, NULL);
+  gtk_widget_hide(item->area);
+}
+
+/* binds tiles to the entries in the viewport plus a margin, reusing tiles that scrolled out */
+static void update_file_grid(file_grid_t* grid) {
+  int stride = icon_width + icon_spacing;
+  double value = grid->adjustment ? gtk_adjustment_get_value(grid->adjustment) : 0;
+  double pageSize = grid->adjustment ? gtk_adjustment_get_page_size(grid->adjustment) : 0;
+  int visibleFirst = (int)value / stride;
+  int visibleLast = (int)(value + pageSize) / stride;
+  int first = MAX(0, visibleFirst - grid_margin_items);
+  int last = MIN((int)grid->entries->len - 1, visibleLast + grid_margin_items);
+
+  thumbnail_set_visible_range(visibleFirst, visibleLast);
+
+  GPtrArray* unused = g_ptr_array_new();
+  gboolean* bound = g_new0(gboolean, MAX(0, last - first + 1));
+  for (guint i = 0; i < grid->items->len; i++) {
+    file_item_t* item = g_ptr_array_index(grid->items, i);
+    if (item->index >= first && item->index <= last) {
+      bound[item->index - first] = TRUE;
+      continue;
+    }
+    if (item->index >= 0) {
+      unbind_item(item);
+    }
+    g_ptr_array_add(unused, item);
+  }
+  for (int index = first; index <= last; index++) {
+    if (bound[index - first]) {
+      continue;
+    }
+    file_item_t* item = unused->len > 0 ? g_ptr_array_remove_index_fast(unused, unused->len - 1) : create_item(grid);
+    bind_item(item, index);
+  }
+  g_free(bound);
+  g_ptr_array_free(unused, TRUE);
+}
+
+static void on_grid_scrolled(GtkAdjustment* adjustment, file_grid_t* grid) {
+  update_file_grid(grid);
+}
+
+static void on_grid_adjustment_set(GObject* layout, GParamSpec* pspec, file_grid_t* grid) {
+  if (grid->adjustment) {
+    g_signal_handlers_disconnect_by_data(grid->adjustment, grid);
+    g_object_unref(grid->adjustment);
+  }
+  grid->adjustment = gtk_scrollable_get_hadjustment(GTK_SCROLLABLE(layout));
+  if (grid->adjustment) {
+    g_object_ref(grid->adjustment);
+    g_signal_connect (grid->adjustment, "value-changed", G_CALLBACK(on_grid_scrolled), grid);
+    g_signal_connect (grid->adjustment, "changed", G_CALLBACK(on_grid_scrolled), grid);
+  }
+}
+
+static void on_grid_destroy(GtkWidget* widget, file_grid_t* grid) {
+  if (grid->adjustment) {
+    g_signal_handlers_disconnect_by_data(grid->adjustment, grid);
+    g_clear_object(&grid->adjustment);
+  }
+}
+
+/* a horizontally scrolling row of file items, add it to a GtkScrolledWindow */
+GtkWidget* get_file_grid() {
+  GtkLayout* layout = gtk_layout_new(NULL, NULL);
+  file_grid_t* grid = (file_grid_t*)g_malloc0(sizeof(file_grid_t));
+  grid->layout = layout;
+  grid->entries = g_array_new(FALSE, TRUE, sizeof(file_entry_t));
+  grid->strings = g_string_chunk_new(4096);
+  grid->items = g_ptr_array_new();
+  grid->icons = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+  g_object_set_data_full(G_OBJECT(layout), "file-grid", grid, free_file_grid);
+
+  gtk_widget_set_size_request(layout, -1, icon_height);
+  g_signal_connect (layout, "notify::hadjustment", G_CALLBACK(on_grid_adjustment_set), grid);
+  g_signal_connect (layout, "destroy", G_CALLBACK(on_grid_destroy), grid);
+  return layout;
+}
+
+/* Removes all entries and frees their strings, pending thumbnails for them are cancelled. */
+void clear_file_items(GtkContainer* container) {
+  file_grid_t* grid = get_file_grid_data(container);
+  thumbnail_cancel_all();
+  for (guint i = 0; i < grid->items->len; i++) {
+    file_item_t* item = g_ptr_array_index(grid->items, i);
+    if (item->index >= 0) {
+      unbind_item(item);
+    }
+  }
+  g_array_set_size(grid->entries, 0);
+  g_string_chunk_clear(grid->strings);
+  gtk_layout_set_size(grid->layout, 0, icon_height);
+  if (grid->adjustment) {
+    gtk_adjustment_set_value(grid->adjustment, 0);
+  }
+}
+
+static void add_file_entry(file_grid_t* grid, file_entry_t* entry) {
+  g_array_append_val(grid->entries, *entry);
+  gtk_layout_set_size(grid->layout, grid->entries->len * (icon_width + icon_spacing), icon_height);
+  update_file_grid(grid);
+}
+
+/* copies string into the storage of the current entries, it is freed by clear_file_items */
+char* file_grid_intern(GtkContainer* container, char* string) {
+  return g_string_chunk_insert(get_file_grid_data(container)->strings, string);
 }
 
 void add_file_item(GtkContainer* container, char* imagePath, char* tooltip, void(*callback)(void), gpointer user_data) {
-  GtkImage* icon = create_item_icon(imagePath);
-  add_file_item_image(container, g_object_ref(icon), tooltip, callback, user_data);
-  g_object_unref(icon);
-};
-
-void add_file_item_from_surface(GtkContainer* container, cairo_surface_t* surface, char* tooltip, void(*callback)(void), gpointer user_data) {
-  GdkPixbuf* pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, cairo_image_surface_get_width (surface), cairo_image_surface_get_height (surface));
-  GdkPixbuf * imgBuf = gdk_pixbuf_scale_simple(pixbuf, icon_image_width, icon_image_height, GDK_INTERP_BILINEAR);
-  GtkImage* icon = gtk_image_new_from_pixbuf(imgBuf);
-  add_file_item_image(container, g_object_ref(icon), tooltip, callback, user_data);
-  g_object_unref(pixbuf);
-  g_object_unref(imgBuf);
-  g_object_unref(icon);
-}
\ No newline at end of file
+  file_grid_t* grid = get_file_grid_data(container);
+  file_entry_t entry = { 0 };
+  entry.iconPath = g_string_chunk_insert_const(grid->strings, imagePath);
+  entry.tooltip = g_string_chunk_insert(grid->strings, tooltip);
+  entry.callback = callback;
+  entry.user_data = user_data;
+  add_file_entry(grid, &entry);
+}
+
+/* Adds an item whose thumbnail is loaded in the background once it scrolls into view. */
+void add_file_item_thumbnail(GtkContainer* container, char* filePath, gint64 size, gint64 mtime, thumbnail_kind_t kind, char* tooltip, void(*callback)(void), gpointer user_data) {
+  file_grid_t* grid = get_file_grid_data(container);
+  file_entry_t entry = { 0 };
+  entry.filePath = g_string_chunk_insert(grid->strings, filePath);
+  entry.size = size;
+  entry.mtime = mtime;
+  entry.kind = kind;
+  entry.tooltip = g_string_chunk_insert(grid->strings, tooltip);
+  entry.callback = callback;
+  entry.user_data = user_data;
+  add_file_entry(grid, &entry);
+}
@@ -1,5 +1,10 @@
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#include "thumbnail.h"
+
+GtkWidget* get_file_grid();
+void clear_file_items(GtkContainer* container);
+char* file_grid_intern(GtkContainer* container, char* string);
 void add_file_item(GtkContainer* container, char* imagePath, char* tooltip, void(*callback)(void), gpointer user_data);
-void add_file_item_from_surface(GtkContainer* container, cairo_surface_t* surface, char* tooltip, void(*callback)(void), gpointer user_data);
\ No newline at end of file
+void add_file_item_thumbnail(GtkContainer* container, char* filePath, gint64 size, gint64 mtime, thumbnail_kind_t kind, char* tooltip, void(*callback)(void), gpointer user_data);
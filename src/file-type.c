@@ -0,0 +1,70 @@
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "file-type.h"
+
+typedef struct {
+  const char* extension;
+  file_type_t type;
+} extension_t;
+
+static const extension_t extensions[] = {
+  { "jpg", FILE_TYPE_IMAGE },
+  { "jpeg", FILE_TYPE_IMAGE },
+  { "jpe", FILE_TYPE_IMAGE },
+  { "png", FILE_TYPE_IMAGE },
+  { "gif", FILE_TYPE_IMAGE },
+  { "bmp", FILE_TYPE_IMAGE },
+  { "tif", FILE_TYPE_IMAGE },
+  { "tiff", FILE_TYPE_IMAGE },
+  { "webp", FILE_TYPE_IMAGE },
+#ifdef HAVE_LIBHEIF
+  { "heic", FILE_TYPE_IMAGE },
+  { "heif", FILE_TYPE_IMAGE },
+#endif
+  { "pdf", FILE_TYPE_PDF },
+  { NULL, FILE_TYPE_OTHER }
+};
+
+/* only used for files without an extension, reads the first bytes */
+static file_type_t get_file_type_from_magic(const char* path) {
+  guchar magic[8] = { 0 };
+  FILE* file = g_fopen(path, "rb");
+  if (NULL == file) {
+    return FILE_TYPE_OTHER;
+  }
+  size_t length = fread(magic, 1, sizeof(magic), file);
+  fclose(file);
+
+  if (length >= 3 && magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF) {
+    return FILE_TYPE_IMAGE;
+  }
+  if (length >= 8 && memcmp(magic, "\x89PNG\r\n\x1a\n", 8) == 0) {
+    return FILE_TYPE_IMAGE;
+  }
+  if (length >= 5 && memcmp(magic, "%PDF-", 5) == 0) {
+    return FILE_TYPE_PDF;
+  }
+  return FILE_TYPE_OTHER;
+}
+
+/* 
+ * Classifies a directory entry by its extension, which is enough for the
+ * files cameras and office software write. Replaces g_content_type_guess.
+ */
+file_type_t get_file_type(const char* path, const char* filename) {
+  if (filename[0] == '.') {
+    return FILE_TYPE_OTHER; // hidden files and macOS resource forks
+  }
+  const char* dot = strrchr(filename, '.');
+  if (NULL == dot) {
+    return get_file_type_from_magic(path);
+  }
+  for (int i = 0; extensions[i].extension; i++) {
+    if (g_ascii_strcasecmp(dot + 1, extensions[i].extension) == 0) {
+      return extensions[i].type;
+    }
+  }
+  return FILE_TYPE_OTHER;
+}
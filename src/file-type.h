@@ -0,0 +1,14 @@
+#ifndef FILE_TYPE_H
+#define FILE_TYPE_H
+
+#include <glib.h>
+
+typedef enum {
+  FILE_TYPE_OTHER,
+  FILE_TYPE_IMAGE,
+  FILE_TYPE_PDF
+} file_type_t;
+
+file_type_t get_file_type(const char* path, const char* filename);
+
+#endif
@@ -0,0 +1,339 @@
+#include <math.h>
+#include <string.h>
+
+#include "imposition.h"
+#include "loader.h"
+#include "thumbnail.h"
+#include "thumbnail-cache.h"
+
+#define IMPOSITION_MARGIN 18.0 // points around the sheet
+#define IMPOSITION_GUTTER 9.0 // points between cells
+#define IMAGE_FILES_CACHE 9 // decoded pictures kept, the cells of one sheet
+#define CONTACT_CAPTION_HEIGHT 12.0
+#define CONTACT_CAPTION_SIZE 7.0
+
+typedef struct {
+  print_source_t* pages; // shared by all copies, owned by the original
+  gpointer pagesData; // pages->data, or a copy for a print worker
+  gboolean isCopy;
+  int columns;
+  int rows;
+  gboolean repeat; // every sheet is filled with copies of one page
+  double sheetWidth; // points
+  double sheetHeight;
+} imposition_t;
+
+typedef struct {
+  char** filenames;
+  int count;
+  int maxWidth; // decode size, the pixels of one cell at output resolution
+  int maxHeight;
+  GHashTable* surfaces; // page -> cairo_surface_t
+  GQueue order; // pages, most recently used first
+} image_files_t;
+
+typedef struct {
+  char** filenames;
+  int count;
+  int columns;
+  int rows;
+  double sheetWidth;
+  double sheetHeight;
+} contact_sheet_t;
+
+static char** copy_filenames(char** filenames, int count) {
+  char** copy = g_new0(char*, count + 1);
+  for (int i = 0; i < count; i++) {
+    copy[i] = g_strdup(filenames[i]);
+  }
+  return copy;
+}
+
+/* rows and columns for 1, 2, 4 or 9 pages per sheet */
+void imposition_get_layout(int perSheet, int* columns, int* rows) {
+  *columns = perSheet >= 9 ? 3 : perSheet >= 4 ? 2 : 1;
+  *rows = perSheet >= 9 ? 3 : perSheet >= 2 ? 2 : 1;
+}
+
+static void get_cell_rect(int columns, int rows, double sheetWidth, double sheetHeight, int index,
+                          double* x, double* y, double* width, double* height) {
+  *width = (sheetWidth - 2 * IMPOSITION_MARGIN - (columns - 1) * IMPOSITION_GUTTER) / columns;
+  *height = (sheetHeight - 2 * IMPOSITION_MARGIN - (rows - 1) * IMPOSITION_GUTTER) / rows;
+  *x = IMPOSITION_MARGIN + (index % columns) * (*width + IMPOSITION_GUTTER);
+  *y = IMPOSITION_MARGIN + (index / columns) * (*height + IMPOSITION_GUTTER);
+}
+
+/* the largest decode a cell can show, either way round since cells may be rotated */
+void imposition_get_cell_pixels(int columns, int rows, double sheetWidth, double sheetHeight, double dpi, int* width, int* height) {
+  double x, y, cellWidth, cellHeight;
+  get_cell_rect(columns, rows, sheetWidth, sheetHeight, 0, &x, &y, &cellWidth, &cellHeight);
+  int size = (int)ceil(MAX(cellWidth, cellHeight) * dpi / 72.0);
+  *width = size;
+  *height = size;
+}
+
+/* only cells that touch the band being rendered are drawn, so the other cells are never decoded */
+static gboolean is_in_clip(cairo_t* cr, double x, double y, double width, double height) {
+  double x1, y1, x2, y2;
+  cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+  return x < x2 && x + width > x1 && y < y2 && y + height > y1;
+}
+
+/* fits a page into a cell, turned by a quarter when that makes it larger */
+static void render_cell(print_source_t* pages, gpointer data, int page, cairo_t* cr, double x, double y, double width, double height) {
+  double pageWidth, pageHeight;
+  pages->get_page_size(data, page, &pageWidth, &pageHeight);
+  double fit = MIN(width / pageWidth, height / pageHeight);
+  double turnedFit = MIN(width / pageHeight, height / pageWidth);
+  gboolean turn = turnedFit > fit;
+
+  cairo_save(cr);
+  cairo_rectangle(cr, x, y, width, height);
+  cairo_clip(cr);
+  cairo_translate(cr, x + width / 2, y + height / 2);
+  if (turn) {
+    cairo_rotate(cr, M_PI / 2);
+  }
+  cairo_scale(cr, turn ? turnedFit : fit, turn ? turnedFit : fit);
+  cairo_translate(cr, -pageWidth / 2, -pageHeight / 2);
+  pages->render(data, page, cr);
+  cairo_restore(cr);
+}
+
+/* ------------------------------------------------------------------------- */
+/* n-up                                                                       */
+
+static int get_imposition_page_count(imposition_t* imposition) {
+  int pages = imposition->pages->get_page_count(imposition->pagesData);
+  int perSheet = imposition->columns * imposition->rows;
+  return imposition->repeat ? pages : (pages + perSheet - 1) / perSheet;
+}
+
+static void get_imposition_page_size(imposition_t* imposition, int sheet, double* width, double* height) {
+  *width = imposition->sheetWidth;
+  *height = imposition->sheetHeight;
+}
+
+static void render_imposition_page(imposition_t* imposition, int sheet, cairo_t* cr) {
+  int perSheet = imposition->columns * imposition->rows;
+  int pages = imposition->pages->get_page_count(imposition->pagesData);
+  for (int i = 0; i < perSheet; i++) {
+    int page = imposition->repeat ? sheet : sheet * perSheet + i;
+    if (page >= pages) {
+      break;
+    }
+    double x, y, width, height;
+    get_cell_rect(imposition->columns, imposition->rows, imposition->sheetWidth, imposition->sheetHeight, i, &x, &y, &width, &height);
+    if (is_in_clip(cr, x, y, width, height)) {
+      render_cell(imposition->pages, imposition->pagesData, page, cr, x, y, width, height);
+    }
+  }
+}
+
+static void free_imposition(imposition_t* imposition) {
+  if (imposition->pages->destroy) {
+    imposition->pages->destroy(imposition->pagesData);
+  }
+  if (!imposition->isCopy) {
+    g_free(imposition->pages);
+  }
+  g_free(imposition);
+}
+
+static imposition_t* copy_imposition(imposition_t* imposition) {
+  imposition_t* copy = g_new0(imposition_t, 1);
+  *copy = *imposition;
+  copy->pagesData = imposition->pages->copy(imposition->pagesData);
+  copy->isCopy = TRUE;
+  return copy;
+}
+
+/*
+ * Places the pages of another source onto sheets, columns x rows per sheet,
+ * taking ownership of pages. Each cell is rendered straight at output
+ * resolution, there is no intermediate raster of the page.
+ */
+print_source_t* imposition_source_new(print_source_t* pages, int columns, int rows, gboolean repeat, double sheetWidth, double sheetHeight) {
+  imposition_t* imposition = g_new0(imposition_t, 1);
+  imposition->pages = pages;
+  imposition->pagesData = pages->data;
+  imposition->columns = MAX(1, columns);
+  imposition->rows = MAX(1, rows);
+  imposition->repeat = repeat;
+  imposition->sheetWidth = sheetWidth;
+  imposition->sheetHeight = sheetHeight;
+
+  print_source_t* source = print_source_new(imposition, (GDestroyNotify)free_imposition);
+  source->get_page_count = (int(*)(gpointer))get_imposition_page_count;
+  source->get_page_size = (void(*)(gpointer, int, double*, double*))get_imposition_page_size;
+  source->render = (void(*)(gpointer, int, cairo_t*))render_imposition_page;
+  if (pages->copy) {
+    source->copy = (gpointer(*)(gpointer))copy_imposition;
+  }
+  return source;
+}
+
+/* ------------------------------------------------------------------------- */
+/* image files                                                                */
+
+static cairo_surface_t* get_image_surface(image_files_t* files, int page) {
+  cairo_surface_t* surface = g_hash_table_lookup(files->surfaces, GINT_TO_POINTER(page));
+  if (surface) {
+    return surface;
+  }
+  surface = load_surface_at_size(files->filenames[page], files->maxWidth, files->maxHeight, NULL);
+  if (NULL == surface) {
+    // keeps the cell empty
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+  }
+  g_hash_table_insert(files->surfaces, GINT_TO_POINTER(page), surface);
+  g_queue_push_head(&files->order, GINT_TO_POINTER(page));
+  while (files->order.length > IMAGE_FILES_CACHE) {
+    g_hash_table_remove(files->surfaces, g_queue_pop_tail(&files->order));
+  }
+  return surface;
+}
+
+static int get_image_files_page_count(image_files_t* files) {
+  return files->count;
+}
+
+static void get_image_files_page_size(image_files_t* files, int page, double* width, double* height) {
+  cairo_surface_t* surface = get_image_surface(files, page);
+  *width = cairo_image_surface_get_width(surface);
+  *height = cairo_image_surface_get_height(surface);
+}
+
+static void render_image_files_page(image_files_t* files, int page, cairo_t* cr) {
+  cairo_set_source_surface(cr, get_image_surface(files, page), 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+}
+
+static void free_image_files(image_files_t* files) {
+  g_strfreev(files->filenames);
+  g_hash_table_destroy(files->surfaces);
+  g_queue_clear(&files->order);
+  g_free(files);
+}
+
+static image_files_t* create_image_files(char** filenames, int count, int maxWidth, int maxHeight) {
+  image_files_t* files = g_new0(image_files_t, 1);
+  files->filenames = copy_filenames(filenames, count);
+  files->count = count;
+  files->maxWidth = maxWidth;
+  files->maxHeight = maxHeight;
+  files->surfaces = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)cairo_surface_destroy);
+  g_queue_init(&files->order);
+  return files;
+}
+
+static image_files_t* copy_image_files(image_files_t* files) {
+  return create_image_files(files->filenames, files->count, files->maxWidth, files->maxHeight);
+}
+
+/* one page per picture, decoded on the print thread at no more than maxWidth x maxHeight */
+print_source_t* image_files_source_new(char** filenames, int count, int maxWidth, int maxHeight) {
+  print_source_t* source = print_source_new(create_image_files(filenames, count, maxWidth, maxHeight), (GDestroyNotify)free_image_files);
+  source->get_page_count = (int(*)(gpointer))get_image_files_page_count;
+  source->get_page_size = (void(*)(gpointer, int, double*, double*))get_image_files_page_size;
+  source->render = (void(*)(gpointer, int, cairo_t*))render_image_files_page;
+  source->copy = (gpointer(*)(gpointer))copy_image_files;
+  return source;
+}
+
+/* ------------------------------------------------------------------------- */
+/* contact sheet                                                              */
+
+static void get_contact_cell_rect(contact_sheet_t* sheet, int index, double* x, double* y, double* width, double* height) {
+  double cellWidth = (sheet->sheetWidth - 2 * IMPOSITION_MARGIN - (sheet->columns - 1) * IMPOSITION_GUTTER) / sheet->columns;
+  *width = cellWidth;
+  *height = cellWidth + CONTACT_CAPTION_HEIGHT;
+  *x = IMPOSITION_MARGIN + (index % sheet->columns) * (cellWidth + IMPOSITION_GUTTER);
+  *y = IMPOSITION_MARGIN + (index / sheet->columns) * (*height + IMPOSITION_GUTTER);
+}
+
+static int get_contact_page_count(contact_sheet_t* sheet) {
+  int perSheet = sheet->columns * sheet->rows;
+  return (sheet->count + perSheet - 1) / perSheet;
+}
+
+static void get_contact_page_size(contact_sheet_t* sheet, int page, double* width, double* height) {
+  *width = sheet->sheetWidth;
+  *height = sheet->sheetHeight;
+}
+
+static void render_contact_cell(contact_sheet_t* sheet, int index, cairo_t* cr, double x, double y, double width, double height) {
+  char* filename = sheet->filenames[index];
+  GdkPixbuf* pixbuf = thumbnail_cache_lookup(filename);
+  if (NULL == pixbuf) {
+    pixbuf = create_thumbnail_pixbuf(filename, THUMBNAIL_IMAGE);
+    thumbnail_cache_store(filename, pixbuf);
+  }
+  double imageHeight = height - CONTACT_CAPTION_HEIGHT;
+  cairo_save(cr);
+  cairo_rectangle(cr, x, y, width, height);
+  cairo_clip(cr);
+  if (pixbuf) {
+    double scale = MIN(width / gdk_pixbuf_get_width(pixbuf), imageHeight / gdk_pixbuf_get_height(pixbuf));
+    cairo_save(cr);
+    cairo_translate(cr, x + (width - gdk_pixbuf_get_width(pixbuf) * scale) / 2, y + (imageHeight - gdk_pixbuf_get_height(pixbuf) * scale) / 2);
+    cairo_scale(cr, scale, scale);
+    gdk_cairo_set_source_pixbuf(cr, pixbuf, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_restore(cr);
+    g_object_unref(pixbuf);
+  }
+  gchar* name = g_path_get_basename(filename);
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, CONTACT_CAPTION_SIZE);
+  cairo_move_to(cr, x, y + height - (CONTACT_CAPTION_HEIGHT - CONTACT_CAPTION_SIZE) / 2);
+  cairo_show_text(cr, name);
+  g_free(name);
+  cairo_restore(cr);
+}
+
+static void render_contact_page(contact_sheet_t* sheet, int page, cairo_t* cr) {
+  int perSheet = sheet->columns * sheet->rows;
+  for (int i = 0; i < perSheet && page * perSheet + i < sheet->count; i++) {
+    double x, y, width, height;
+    get_contact_cell_rect(sheet, i, &x, &y, &width, &height);
+    if (is_in_clip(cr, x, y, width, height)) {
+      render_contact_cell(sheet, page * perSheet + i, cr, x, y, width, height);
+    }
+  }
+}
+
+static void free_contact_sheet(contact_sheet_t* sheet) {
+  g_strfreev(sheet->filenames);
+  g_free(sheet);
+}
+
+static contact_sheet_t* copy_contact_sheet(contact_sheet_t* sheet) {
+  contact_sheet_t* copy = g_new0(contact_sheet_t, 1);
+  *copy = *sheet;
+  copy->filenames = copy_filenames(sheet->filenames, sheet->count);
+  return copy;
+}
+
+/* an index of pictures, columns per row, drawn from the thumbnail cache instead of decoding the pictures */
+print_source_t* contact_sheet_source_new(char** filenames, int count, int columns, double sheetWidth, double sheetHeight) {
+  contact_sheet_t* sheet = g_new0(contact_sheet_t, 1);
+  sheet->filenames = copy_filenames(filenames, count);
+  sheet->count = count;
+  sheet->columns = MAX(1, columns);
+  sheet->sheetWidth = sheetWidth;
+  sheet->sheetHeight = sheetHeight;
+  double x, y, width, height;
+  get_contact_cell_rect(sheet, 0, &x, &y, &width, &height);
+  sheet->rows = MAX(1, (int)((sheetHeight - 2 * IMPOSITION_MARGIN + IMPOSITION_GUTTER) / (height + IMPOSITION_GUTTER)));
+
+  print_source_t* source = print_source_new(sheet, (GDestroyNotify)free_contact_sheet);
+  source->get_page_count = (int(*)(gpointer))get_contact_page_count;
+  source->get_page_size = (void(*)(gpointer, int, double*, double*))get_contact_page_size;
+  source->render = (void(*)(gpointer, int, cairo_t*))render_contact_page;
+  source->copy = (gpointer(*)(gpointer))copy_contact_sheet;
+  return source;
+}
@@ -0,0 +1,14 @@
+#ifndef IMPOSITION_H
+#define IMPOSITION_H
+
+#include <gtk/gtk.h>
+
+#include "print-job.h"
+
+void imposition_get_layout(int perSheet, int* columns, int* rows);
+void imposition_get_cell_pixels(int columns, int rows, double sheetWidth, double sheetHeight, double dpi, int* width, int* height);
+print_source_t* imposition_source_new(print_source_t* pages, int columns, int rows, gboolean repeat, double sheetWidth, double sheetHeight);
+print_source_t* image_files_source_new(char** filenames, int count, int maxWidth, int maxHeight);
+print_source_t* contact_sheet_source_new(char** filenames, int count, int columns, double sheetWidth, double sheetHeight);
+
+#endif
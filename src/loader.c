@@ -0,0 +1,137 @@
+#include "loader.h"
+#include "color.h"
+#include "decoder.h"
+#include "file-map.h"
+#include "trace.h"
+
+/* lets the codec decode at the target size, JPEG uses DCT scaling for this */
+static void on_size_prepared(GdkPixbufLoader* loader, int width, int height, decode_size_t* size) {
+  if (size->width <= 0 || size->height <= 0) {
+    return;
+  }
+  double wScale = (double)size->width / width;
+  double hScale = (double)size->height / height;
+  double scale = size->cover ? MAX(wScale, hScale) : MIN(wScale, hScale);
+  if (scale >= 1.0) {
+    return;
+  }
+  gdk_pixbuf_loader_set_size(loader, MAX(1, (int)(width * scale + 0.5)), MAX(1, (int)(height * scale + 0.5)));
+}
+
+static GdkPixbuf* finish_loader(GdkPixbufLoader* loader, gboolean ok, GError** error) {
+  ok = gdk_pixbuf_loader_close(loader, ok ? error : NULL) && ok;
+  GdkPixbuf* result = NULL;
+  GdkPixbuf* decoded = ok ? gdk_pixbuf_loader_get_pixbuf(loader) : NULL;
+  if (decoded) {
+    result = gdk_pixbuf_apply_embedded_orientation(decoded);
+    if (result != decoded) {
+      gdk_pixbuf_copy_options(decoded, result); // keeps the ICC profile of turned pictures
+    }
+  }
+  g_object_unref(loader);
+  return result;
+}
+
+static GdkPixbuf* load_pixbuf_bytes(const guchar* data, gsize length, decode_size_t* size, GError** error) {
+  GdkPixbufLoader* loader = gdk_pixbuf_loader_new();
+  g_signal_connect(loader, "size-prepared", G_CALLBACK(on_size_prepared), size);
+  gboolean ok = gdk_pixbuf_loader_write(loader, data, length, error);
+  return finish_loader(loader, ok, error);
+}
+
+/* the file is shared through the session mapping or read cache, the loader never copies it */
+static GdkPixbuf* load_pixbuf(char* filename, decode_size_t* size, GError** error) {
+  GBytes* bytes = file_map_get(filename, error);
+  if (NULL == bytes) {
+    return NULL;
+  }
+  gsize length;
+  const guchar* data = g_bytes_get_data(bytes, &length);
+  GdkPixbuf* result = load_pixbuf_bytes(data, length, size, error);
+  g_bytes_unref(bytes);
+  return result;
+}
+
+/* decodes an in-memory image, at most maxWidth x maxHeight, 0 means full size */
+GdkPixbuf* load_pixbuf_from_data(const guchar* data, gsize length, int maxWidth, int maxHeight, GError** error) {
+  decode_size_t size = { maxWidth, maxHeight, FALSE };
+  return load_pixbuf_bytes(data, length, &size, error);
+}
+
+/* decodes at most maxWidth x maxHeight keeping the aspect ratio, 0 means full size */
+GdkPixbuf* load_pixbuf_at_size(char* filename, int maxWidth, int maxHeight, GError** error) {
+  decode_size_t size = { maxWidth, maxHeight, FALSE };
+  return load_pixbuf(filename, &size, error);
+}
+
+/* decodes at the smallest size that still covers width x height */
+GdkPixbuf* load_pixbuf_covering(char* filename, int width, int height, GError** error) {
+  decode_size_t size = { width, height, TRUE };
+  return load_pixbuf(filename, &size, error);
+}
+
+/* GdkPixbuf keeps the embedded ICC profile of some formats, e.g. TIFF, as a base64 option */
+static GBytes* get_pixbuf_profile(GdkPixbuf* pixbuf) {
+  const gchar* encoded = gdk_pixbuf_get_option(pixbuf, "icc-profile");
+  if (NULL == encoded) {
+    return NULL;
+  }
+  gsize length;
+  guchar* profile = g_base64_decode(encoded, &length);
+  return g_bytes_new_take(profile, length);
+}
+
+/* pictures are shown, edited and printed in sRGB, the conversion runs after scaling to the target size */
+static void convert_to_srgb(cairo_surface_t* surface, GBytes* profile) {
+  color_transform_t* transform = color_get_transform(profile, NULL, COLOR_INTENT_PERCEPTUAL, cairo_image_surface_get_format(surface));
+  if (transform) {
+    color_transform_surface(transform, surface);
+  }
+}
+
+/* formats with a direct decoder skip GdkPixbuf, the rest are converted from a pixbuf */
+static cairo_surface_t* load_surface(char* filename, decode_size_t* size, GError** error) {
+  GBytes* bytes = file_map_get(filename, error);
+  if (NULL == bytes) {
+    return NULL;
+  }
+  gsize length;
+  const guchar* data = g_bytes_get_data(bytes, &length);
+  cairo_surface_t* surface = NULL;
+  GBytes* profile = NULL;
+  const decoder_t* decoder = decoder_find(data, length);
+  if (decoder) {
+    TRACE_SCOPE(decoder->traceName);
+    surface = decoder->decode(data, length, size, error);
+    surface = surface ? decoder_fit_surface(surface, size) : NULL;
+    if (surface && color_is_enabled()) {
+      profile = decoder->get_profile(data, length);
+    }
+  } else {
+    TRACE_SCOPE("decode pixbuf");
+    GdkPixbuf* pixbuf = load_pixbuf_bytes(data, length, size, error);
+    if (pixbuf) {
+      surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1, NULL);
+      profile = color_is_enabled() ? get_pixbuf_profile(pixbuf) : NULL;
+      g_object_unref(pixbuf);
+    }
+  }
+  if (profile) {
+    convert_to_srgb(surface, profile);
+    g_bytes_unref(profile);
+  }
+  g_bytes_unref(bytes);
+  return surface;
+}
+
+/* decodes into a cairo image surface of at most maxWidth x maxHeight, 0 means full size */
+cairo_surface_t* load_surface_at_size(char* filename, int maxWidth, int maxHeight, GError** error) {
+  decode_size_t size = { maxWidth, maxHeight, FALSE };
+  return load_surface(filename, &size, error);
+}
+
+/* decodes into a cairo image surface at the smallest size that still covers width x height */
+cairo_surface_t* load_surface_covering(char* filename, int width, int height, GError** error) {
+  decode_size_t size = { width, height, TRUE };
+  return load_surface(filename, &size, error);
+}
@@ -0,0 +1,8 @@
+#include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+GdkPixbuf* load_pixbuf_at_size(char* filename, int maxWidth, int maxHeight, GError** error);
+GdkPixbuf* load_pixbuf_covering(char* filename, int width, int height, GError** error);
+GdkPixbuf* load_pixbuf_from_data(const guchar* data, gsize length, int maxWidth, int maxHeight, GError** error);
+cairo_surface_t* load_surface_at_size(char* filename, int maxWidth, int maxHeight, GError** error);
+cairo_surface_t* load_surface_covering(char* filename, int width, int height, GError** error);
@@ -5,10 +5,17 @@
 #include "picture.h"
 #include "file-select.h"
 #include "pdf.h"
+#include "file-type.h"
+#include "file-map.h"
+#include "prefetch.h"
+#include "print-job.h"
+#include "imposition.h"
+#include "trace.h"
+#include "memory-budget.h"
 
 /* static local ui elements */
 static GtkWindow* _mainWindow = NULL;
-static GtkBox* imageGrid = NULL;
+static GtkLayout* imageGrid = NULL;
 static GtkLabel* infoLabel = NULL;
 static GtkDrawingArea* pictureArea = NULL;
 static GtkBox* jobPicturesBox = NULL;
@@ -16,22 +23,44 @@ static GtkScrolledWindow* toolbox = NULL;
 
 char* root_mount_dir;
 
-#define A4_WIDTH_72 595
-#define A4_HEIGHT_72 842
-
 typedef struct {
   char* path;
   char* name;
 } folder_t;
 
-typedef struct {
-  folder_t*  prev;
+typedef struct folder_node {
+  struct folder_node* prev;
   folder_t*  data;
+  int refCount; // held by the child folders and as the current folder
 } folder_node_t;
 
+#define DIR_BATCH_SIZE 64
+
+/* one asynchronous directory listing, abandoned when another folder is opened */
+typedef struct {
+  GCancellable* cancellable;
+  GFileEnumerator* enumerator;
+  char* path;
+} dir_listing_t;
+
+static GCancellable* dirCancellable = NULL;
+
+static print_job_t* currentPrintJob = NULL; // one job at a time, the print button cancels it
+static GtkWidget* printButton = NULL;
+static int printPerSheet = 1; // pictures or pages per sheet
+
+#define CONTACT_SHEET_COLUMNS 5
+
+static folder_node_t* currentFolder = NULL;
+
+static GPtrArray* folderImages = NULL; // paths of the pictures in the open folder, for the contact sheet, owned by the grid
+
 /* local definitions */
 static void open_dir(folder_node_t* parent, char* path, char* name);
+static void open_folder(folder_node_t* node);
+static folder_node_t* ref_folder(folder_node_t* node);
 static void on_render_pdf(cairo_surface_t* surface, int width, int height);
+static void on_render_pdf_tiled(tile_view_t* view);
 
 static void hello( GtkWidget *widget,
                    gpointer   data )
@@ -63,27 +92,168 @@ static void destroy( GtkWidget *widget, gpointer data )
     gtk_main_quit ();
 }
 
+static void set_print_button_label() {
+  if (printButton) {
+    gtk_button_set_label(GTK_BUTTON(printButton), currentPrintJob ? "Abbrechen" : "Drucken");
+  }
+}
+
+static void on_print_progress(int page, int pageCount, double pagesPerSecond, gpointer data) {
+  gchar* text = g_strdup_printf("Abbrechen (%i / %i, %.1f/s)", page, pageCount, pagesPerSecond);
+  if (printButton) {
+    gtk_button_set_label(GTK_BUTTON(printButton), text);
+  }
+  g_free(text);
+}
+
+static void on_print_done(GError* error, gchar* path) {
+  currentPrintJob = NULL;
+  if (error) {
+    g_print("Print failed: %s\n", error->message);
+  } else {
+    g_print("Print job written to %s\n", path);
+  }
+  g_free(path);
+  set_print_button_label();
+}
+
+static void start_print_job(print_source_t* source) {
+  gchar* path = get_print_spool_path();
+  currentPrintJob = print_job_start(source, path, PRINT_DEFAULT_DPI, PRINT_A4_WIDTH, PRINT_A4_HEIGHT,
+                                    on_print_progress, (print_done_callback_t)on_print_done, path);
+  set_print_button_label();
+}
+
+static void click_print( GtkWidget *widget, gpointer type )
+{
+  if (currentPrintJob) {
+    print_job_cancel(currentPrintJob);
+    return;
+  }
+  int columns, rows;
+  imposition_get_layout(printPerSheet, &columns, &rows);
+  print_source_t* source = NULL;
+  if (GPOINTER_TO_INT(type) == FILE_TYPE_PDF) {
+    source = get_pdf_print_source(0, G_MAXINT);
+  } else {
+    // decode only as large as one cell of the sheet
+    double scale = PRINT_DEFAULT_DPI / 72.0;
+    int width = (int)(PRINT_A4_WIDTH * scale), height = (int)(PRINT_A4_HEIGHT * scale);
+    if (printPerSheet > 1) {
+      imposition_get_cell_pixels(columns, rows, PRINT_A4_WIDTH, PRINT_A4_HEIGHT, PRINT_DEFAULT_DPI, &width, &height);
+    }
+    source = get_picture_print_source(width, height);
+  }
+  if (NULL == source) {
+    return;
+  }
+  if (printPerSheet > 1) {
+    // several pages of a document per sheet, or copies of one picture
+    source = imposition_source_new(source, columns, rows, GPOINTER_TO_INT(type) != FILE_TYPE_PDF, PRINT_A4_WIDTH, PRINT_A4_HEIGHT);
+  }
+  start_print_job(source);
+}
+
+static void click_contact_sheet( GtkWidget *widget, gpointer data )
+{
+  if (currentPrintJob || NULL == folderImages || folderImages->len == 0) {
+    return;
+  }
+  start_print_job(contact_sheet_source_new((char**)folderImages->pdata, folderImages->len, CONTACT_SHEET_COLUMNS, PRINT_A4_WIDTH, PRINT_A4_HEIGHT));
+}
+
+/* every picture of the open folder, printPerSheet different pictures per sheet */
+static void click_print_folder( GtkWidget *widget, gpointer data )
+{
+  if (currentPrintJob || NULL == folderImages || folderImages->len == 0) {
+    return;
+  }
+  int columns, rows;
+  imposition_get_layout(printPerSheet, &columns, &rows);
+  double scale = PRINT_DEFAULT_DPI / 72.0;
+  int width = (int)(PRINT_A4_WIDTH * scale), height = (int)(PRINT_A4_HEIGHT * scale);
+  if (printPerSheet > 1) {
+    imposition_get_cell_pixels(columns, rows, PRINT_A4_WIDTH, PRINT_A4_HEIGHT, PRINT_DEFAULT_DPI, &width, &height);
+  }
+  print_source_t* source = image_files_source_new((char**)folderImages->pdata, folderImages->len, width, height);
+  if (printPerSheet > 1) {
+    source = imposition_source_new(source, columns, rows, FALSE, PRINT_A4_WIDTH, PRINT_A4_HEIGHT);
+  }
+  start_print_job(source);
+}
+
+static void change_per_sheet( GtkComboBox *combo, gpointer data )
+{
+  printPerSheet = atoi(gtk_combo_box_get_active_id(combo));
+}
+
+/* replaces the toolbox content with toolbar and a print button for the shown file type */
+static void show_toolbar(GtkWidget* toolbar, file_type_t type) {
+  clear_container(toolbox);
+  GtkBox* vBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+  gtk_box_pack_start(vBox, toolbar, FALSE, FALSE, 0);
+  printButton = gtk_button_new();
+  g_signal_connect(printButton, "destroy", G_CALLBACK(gtk_widget_destroyed), &printButton);
+  g_signal_connect(printButton, "clicked", G_CALLBACK(click_print), GINT_TO_POINTER(type));
+  set_print_button_label();
+  gtk_box_pack_end(vBox, printButton, FALSE, FALSE, 4);
+
+  GtkWidget* perSheet = gtk_combo_box_text_new();
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(perSheet), "1", "1 pro Blatt");
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(perSheet), "2", "2 pro Blatt");
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(perSheet), "4", "4 pro Blatt");
+  gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(perSheet), "9", "9 pro Blatt");
+  gchar* activeId = g_strdup_printf("%i", printPerSheet);
+  gtk_combo_box_set_active_id(GTK_COMBO_BOX(perSheet), activeId);
+  g_free(activeId);
+  g_signal_connect(perSheet, "changed", G_CALLBACK(change_per_sheet), NULL);
+  gtk_box_pack_end(vBox, perSheet, FALSE, FALSE, 4);
+
+  if (type == FILE_TYPE_IMAGE) {
+    GtkWidget* contactSheet = gtk_button_new_with_label("Kontaktbogen");
+    g_signal_connect(contactSheet, "clicked", G_CALLBACK(click_contact_sheet), NULL);
+    gtk_box_pack_end(vBox, contactSheet, FALSE, FALSE, 4);
+    GtkWidget* printFolder = gtk_button_new_with_label("Alle Bilder drucken");
+    g_signal_connect(printFolder, "clicked", G_CALLBACK(click_print_folder), NULL);
+    gtk_box_pack_end(vBox, printFolder, FALSE, FALSE, 4);
+  }
+  gtk_container_add(GTK_CONTAINER(toolbox), vBox);
+  gtk_widget_show_all(toolbox);
+}
+
 static void click_image( GtkWidget *widget, GdkEvent* ev, gchar* filename )
 {
+  prefetch_notify_interactive();
   load_current_picture(filename);
   gtk_widget_queue_draw (pictureArea);
+
+  show_toolbar(get_effects_toolbar(), FILE_TYPE_IMAGE);
 }
 
 static void click_pdf ( GtkWidget *widget, GdkEvent* ev, gchar* filename ) {
-  set_current_picture(get_pdf_cairo_surface(filename, 0, A4_WIDTH_72, A4_HEIGHT_72), A4_WIDTH_72, A4_HEIGHT_72);
-  
-  clear_container(toolbox);
-  
-  gtk_container_add(GTK_CONTAINER(toolbox), get_pdf_toolbar(on_render_pdf));
+  prefetch_notify_interactive();
+  // render for the preview area, not at a fixed page size
+  int width = MAX(gtk_widget_get_allocated_width(pictureArea), 1);
+  int height = MAX(gtk_widget_get_allocated_height(pictureArea), 1);
+  if (!open_pdf_document(filename, width, height)) {
+    set_current_picture(NULL, 0, 0);
+    gtk_widget_queue_draw (pictureArea);
+    return;
+  }
   
-  gtk_widget_queue_draw (pictureArea);
+  show_toolbar(get_pdf_toolbar(on_render_pdf, on_render_pdf_tiled), FILE_TYPE_PDF);
   
-  gtk_widget_show_all(toolbox);
+  render_current_pdf_page();
 }
 
-static void click_folder( GtkWidget *widget, GdkEvent* ev, folder_node_t* folder )
+static void click_folder( GtkWidget *widget, GdkEvent* ev, gchar* name )
 {
-  open_dir(folder->prev, folder->data->path, folder->data->name);
+  open_dir(currentFolder, NULL, name);
+}
+
+static void click_back( GtkWidget *widget, GdkEvent* ev, gpointer data )
+{
+  open_folder(ref_folder(currentFolder->prev));
 }
 
 static void show_error_message(GtkWindow* parent, char* message) {
@@ -98,26 +268,29 @@ static void show_error_message(GtkWindow* parent, char* message) {
 
 const int imageGridSize = 128;
 
-static void add_image(char* path, char* filename) {
-  gchar* filePath = g_strconcat(path, "/", filename, NULL);
-  add_file_item(imageGrid, filePath, filename, click_image, filePath);
+/* entry strings live in the grid until the folder is left */
+static void add_image(char* filePath, char* filename, GFileInfo* info) {
+  filePath = file_grid_intern(imageGrid, filePath);
+  g_ptr_array_add(folderImages, filePath);
+  add_file_item_thumbnail(imageGrid, filePath, g_file_info_get_size(info),
+                          g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                          THUMBNAIL_IMAGE, filename, click_image, filePath);
 }
 
-static void add_folder(folder_node_t* node, char* icon) {
+static void add_folder(char* name, char* icon) {
   const char* folderIcon = icon ? icon : "/usr/share/pixmaps/gnome-folder.png"; // TODO: Make this non-magic!
-  g_print("Adding folder %s\n", node->data->path);
-  add_file_item(imageGrid, folderIcon, node->data->name ? node->data->name : node->data->path, click_folder, node);
+  add_file_item(imageGrid, folderIcon, name, click_folder, file_grid_intern(imageGrid, name));
 }
 
-static void add_pdf(char* path, char* filename) {
-  const char* pdfIcon = "assets/pdf.png";
-  gchar* filePath = g_strconcat(path, "/", filename, NULL);
-  cairo_surface_t* surf = get_pdf_thumbnail_cairo_surface(filePath, 128, 128);
-  if (NULL == surf) {
-    add_file_item(imageGrid, pdfIcon, filename, click_pdf, filePath);
-    return;
-  }
-  add_file_item_from_surface(imageGrid, surf, filename, click_pdf, filePath);
+static void add_back_folder(folder_node_t* parent) {
+  add_file_item(imageGrid, "./assets/back.png", parent->data->name, click_back, NULL);
+}
+
+static void add_pdf(char* filePath, char* filename, GFileInfo* info) {
+  filePath = file_grid_intern(imageGrid, filePath);
+  add_file_item_thumbnail(imageGrid, filePath, g_file_info_get_size(info),
+                          g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                          THUMBNAIL_PDF, filename, click_pdf, filePath);
 }
 
 int startsWith(const char *pre, const char *str)
@@ -129,82 +302,205 @@ int startsWith(const char *pre, const char *str)
 
 
 
+/* a folder below parent, or a root folder at path; takes a reference to parent */
 folder_node_t* createFolder(folder_node_t* parent, char* path, char* name) {
   folder_node_t* newNode = (folder_node_t*)g_malloc(sizeof(folder_node_t));
   
   newNode->data = (folder_t*)g_malloc(sizeof(folder_t));
-  newNode->data->path = (parent) ? g_strconcat(parent->data->path, "/", name, NULL) : path;
-  newNode->data->name = name ? name : path;
-  newNode->prev = parent;
+  newNode->data->path = (parent) ? g_build_filename(parent->data->path, name, NULL) : g_strdup(path);
+  newNode->data->name = g_strdup(name ? name : path);
+  newNode->prev = parent ? ref_folder(parent) : NULL;
+  newNode->refCount = 1;
   
   return newNode;
 }
 
-static void open_dir(folder_node_t* parent, char* path, char* name) {
-  GDir *dir;
-  GError *error = NULL;
-  const gchar *filename;
-  
-  folder_node_t* newNode = createFolder(parent, path, name);
-  
-  // char* dirPath = path ? g_build_filename (root, path, NULL) : root;
-  dir = g_dir_open(path, 0, &error);
+static folder_node_t* ref_folder(folder_node_t* node) {
+  node->refCount++;
+  return node;
+}
+
+/* frees node and the parents nobody else refers to */
+static void release_folder(folder_node_t* node) {
+  while (node && --node->refCount == 0) {
+    folder_node_t* parent = node->prev;
+    g_free(node->data->path);
+    g_free(node->data->name);
+    g_free(node->data);
+    g_free(node);
+    node = parent;
+  }
+}
+
+static void free_dir_listing(dir_listing_t* listing) {
+  if (listing->enumerator) {
+    g_file_enumerator_close_async(listing->enumerator, G_PRIORITY_LOW, NULL, NULL, NULL);
+    g_object_unref(listing->enumerator);
+  }
+  g_object_unref(listing->cancellable);
+  g_free(listing->path);
+  g_free(listing);
+}
+
+static void add_dir_entry(dir_listing_t* listing, GFileInfo* info) {
+  const char* filename = g_file_info_get_name(info);
+  if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
+    add_folder(filename, "./assets/folder.png");
+    return;
+  }
+  gchar* filePath = g_build_filename(listing->path, filename, NULL);
+  switch (get_file_type(filePath, filename)) {
+    case FILE_TYPE_IMAGE:
+      add_image(filePath, filename, info);
+      break;
+    case FILE_TYPE_PDF:
+      add_pdf(filePath, filename, info);
+      break;
+    default:
+      break;
+  }
+  g_free(filePath);
+}
+
+static void on_dir_batch(GObject* source, GAsyncResult* res, gpointer data) {
+  dir_listing_t* listing = (dir_listing_t*)data;
+  GError* error = NULL;
+  GList* files = g_file_enumerator_next_files_finish(listing->enumerator, res, &error);
+
+  if (g_cancellable_is_cancelled(listing->cancellable) || NULL != error || NULL == files) {
+    // cancelled because another folder was opened, failed or done
+    if (error) {
+      g_print("%s\n", error->message);
+      g_error_free(error);
+    }
+    g_list_free_full(files, g_object_unref);
+    free_dir_listing(listing);
+    return;
+  }
+  TRACE_SCOPE("open_dir batch");
+  TRACE_COUNT("open_dir entries", g_list_length(files));
+  for (GList* iter = files; iter != NULL; iter = g_list_next(iter)) {
+    add_dir_entry(listing, G_FILE_INFO(iter->data));
+  }
+  g_list_free_full(files, g_object_unref);
+  // one batch per main loop iteration, the grid is drawn in between
+  g_file_enumerator_next_files_async(listing->enumerator, DIR_BATCH_SIZE, G_PRIORITY_DEFAULT, listing->cancellable, on_dir_batch, listing);
+}
+
+static void on_dir_enumerated(GObject* source, GAsyncResult* res, gpointer data) {
+  dir_listing_t* listing = (dir_listing_t*)data;
+  GError* error = NULL;
+  listing->enumerator = g_file_enumerate_children_finish(G_FILE(source), res, &error);
+
+  if (g_cancellable_is_cancelled(listing->cancellable)) {
+    g_clear_error(&error);
+    free_dir_listing(listing);
+    return;
+  }
   if (error) {
     g_print("ERROR\n");
     show_error_message(_mainWindow, error->message);
+    g_error_free(error);
+    free_dir_listing(listing);
+    return;
   }
-  clear_container((GtkContainer*)imageGrid);
+  g_file_enumerator_next_files_async(listing->enumerator, DIR_BATCH_SIZE, G_PRIORITY_DEFAULT, listing->cancellable, on_dir_batch, listing);
+}
+
+/* opens a folder below parent, or the root folder at path */
+static void open_dir(folder_node_t* parent, char* path, char* name) {
+  // name may belong to the grid, which is cleared when the folder is opened
+  open_folder(createFolder(parent, path, name));
+}
+
+/* lists node in the grid, adopts a reference to node */
+static void open_folder(folder_node_t* node) {
+  TRACE_SCOPE("open_dir");
+  release_folder(currentFolder);
+  currentFolder = node;
+  prefetch_notify_interactive();
   
-  if (parent) {
-    add_folder(parent, "./assets/back.png");
+  if (dirCancellable) {
+    g_cancellable_cancel(dirCancellable);
+    g_object_unref(dirCancellable);
   }
+  dirCancellable = g_cancellable_new();
   
-  while ((filename = g_dir_read_name(dir))) {
-    // Check for directory
-    const char* filePath = g_strconcat(path, "/", filename, NULL);
-    if (g_file_test(filePath, G_FILE_TEST_IS_DIR)) {
-      add_folder(createFolder(newNode, filePath, filename), "./assets/folder.png");
-      continue;
-    }
-    // Check for image files
-    gboolean is_certain = FALSE;
-    char *content_type = g_content_type_guess (filename, NULL, 0, &is_certain);
-    if (content_type != NULL)
-    {
-      char *mime_type = g_content_type_get_mime_type (content_type);
-      g_print(mime_type);
-      g_print("\n");
-      if (startsWith("image/", (const char*)mime_type)) {
-        add_image(path, filename);
-      }
-      if (startsWith("application/pdf", (const char*)mime_type)) {
-        add_pdf(path, filename);
-      }
-      g_free(mime_type);
-    }
-    g_free(content_type);
+  clear_file_items((GtkContainer*)imageGrid);
+  if (folderImages) {
+    g_ptr_array_free(folderImages, TRUE);
+  }
+  folderImages = g_ptr_array_new();
+  
+  if (node->prev) {
+    add_back_folder(node->prev);
   }
   gtk_widget_hide(infoLabel);
   gtk_widget_show(imageGrid);
-  g_dir_close(dir);
+  
+  dir_listing_t* listing = (dir_listing_t*)g_malloc0(sizeof(dir_listing_t));
+  listing->cancellable = g_object_ref(dirCancellable);
+  listing->path = g_strdup(node->data->path);
+  
+  GFile* dir = g_file_new_for_path(listing->path);
+  g_file_enumerate_children_async(dir,
+    // size and mtime key the thumbnail memory cache without a stat on the main thread
+    G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+    G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, listing->cancellable, on_dir_enumerated, listing);
+  g_object_unref(dir);
 }
 
 static void on_mount_added (GVolumeMonitor *volume_monitor,
                GMount          *mount,
                gpointer        user_data) {
   GFile* newMountRoot = g_mount_get_root(mount);
-  g_print("Added mount ");
-  g_print(g_file_get_path(newMountRoot));
-  g_print("\n");
+  g_free(root_mount_dir);
   root_mount_dir = g_file_get_path(newMountRoot);
+  g_object_unref(newMountRoot);
+  g_print("Added mount %s\n", root_mount_dir);
+  file_map_add_removable_root(root_mount_dir);
   open_dir(NULL, root_mount_dir, "Speichergerät");
+  prefetch_start(root_mount_dir);
 }
 
+static void on_mount_removed (GVolumeMonitor *volume_monitor,
+               GMount          *mount,
+               gpointer        user_data) {
+  GFile* mountRoot = g_mount_get_root(mount);
+  char* path = g_file_get_path(mountRoot);
+  g_object_unref(mountRoot);
+  g_print("Removed mount %s\n", path);
+  if (path) {
+    file_map_remove_removable_root(path);
+  }
+  if (NULL == path || g_strcmp0(path, root_mount_dir) == 0) {
+    prefetch_stop();
+    if (currentPrintJob) {
+      print_job_cancel(currentPrintJob);
+    }
+    // nothing of the removed stick stays open, the tiles and mipmap of the shown picture go with it
+    if (dirCancellable) {
+      g_cancellable_cancel(dirCancellable);
+    }
+    clear_file_items((GtkContainer*)imageGrid);
+    if (folderImages) {
+      g_ptr_array_set_size(folderImages, 0);
+    }
+    clear_container(toolbox);
+    close_pdf_document();
+    load_current_picture("./assets/default.png");
+    gtk_widget_queue_draw(pictureArea);
+    gtk_widget_hide(imageGrid);
+    gtk_widget_show(infoLabel);
+  }
+  g_free(path);
+}
 
 static void init_device_control() {
   GVolumeMonitor * monitor = g_volume_monitor_get ();
   
   g_signal_connect (monitor, "mount-added", G_CALLBACK (on_mount_added), NULL);
+  g_signal_connect (monitor, "mount-removed", G_CALLBACK (on_mount_removed), NULL);
   
 }
 
@@ -213,9 +509,23 @@ static void on_render_pdf(cairo_surface_t* surface, int width, int height) {
   gtk_widget_queue_draw (pictureArea);
 }
 
+static void on_render_pdf_tiled(tile_view_t* view) {
+  set_current_tiled_picture(view);
+  gtk_widget_queue_draw (pictureArea);
+}
+
 int main( int   argc,
           char *argv[] )
 {
+    trace_init();
+    trace_watch_signals();
+    memory_budget_init();
+    // pages rendered ahead and behind the shown PDF page, more makes paging faster on terminals with memory to spare
+    const char* prerenderPages = g_getenv("PICTURE_BOX_PRERENDER_PAGES");
+    if (prerenderPages && prerenderPages[0]) {
+      set_pdf_prerender_pages(atoi(prerenderPages));
+    }
+
     GtkWidget *window;
     GtkWidget *button;
 
@@ -256,8 +566,7 @@ int main( int   argc,
     gtk_box_pack_start (pictureBox, pictureArea, TRUE, TRUE, 4);
     gtk_box_pack_start (pictureBox, toolbox, TRUE, TRUE, 4);
     
-    imageGrid = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
-    gtk_grid_set_column_spacing(imageGrid, 4);
+    imageGrid = get_file_grid();
     
     infoLabel = gtk_label_new ("Bitte Speichermedium einführen");
     
@@ -277,11 +586,14 @@ int main( int   argc,
     
     load_current_picture("./assets/default.png");
     
+    thumbnail_init();
     init_device_control();
     
     //gtk_window_fullscreen (_mainWindow);
 
     gtk_main ();
     
+    trace_shutdown();
+    
     return 0;
 }
\ No newline at end of file
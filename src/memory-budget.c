@@ -0,0 +1,116 @@
+#include <stdlib.h>
+
+#include "memory-budget.h"
+#include "trace.h"
+
+#define MEMORY_BUDGET_DEFAULT_MB 256
+#define MEMORY_BUDGET_LOW_WATER 0.8 // eviction stops below this fraction of the budget
+#define MEMORY_BUDGET_TIGHT 0.9 // optional work, e.g. prerendering, is skipped above this fraction
+
+typedef struct {
+  const char* name;
+  gint64 used;
+  memory_evict_callback_t evict;
+  gpointer data;
+} memory_pool_info_t;
+
+static GMutex budgetMutex;
+static gint64 budget = (gint64)MEMORY_BUDGET_DEFAULT_MB * 1024 * 1024;
+static gint64 totalUsed = 0;
+static guint evictionIdle = 0;
+
+// in eviction order
+static memory_pool_info_t pools[MEMORY_POOL_COUNT] = {
+  { "memory pdf pages" },
+  { "memory tiles" },
+  { "memory thumbnails" },
+  { "memory files" },
+  { "memory previews" },
+  { "memory print pages" }
+};
+
+/* the budget comes from PICTURE_BOX_MEMORY_MB, call before any cache is filled */
+void memory_budget_init() {
+  const char* megabytes = g_getenv("PICTURE_BOX_MEMORY_MB");
+  if (megabytes && atoi(megabytes) > 0) {
+    budget = (gint64)atoi(megabytes) * 1024 * 1024;
+  }
+  g_print("Memory budget %" G_GINT64_FORMAT " MB\n", budget / (1024 * 1024));
+}
+
+void memory_budget_set_evictor(memory_pool_t pool, memory_evict_callback_t evict, gpointer data) {
+  g_mutex_lock(&budgetMutex);
+  pools[pool].evict = evict;
+  pools[pool].data = data;
+  g_mutex_unlock(&budgetMutex);
+}
+
+static gboolean run_eviction(gpointer data) {
+  gint64 lowWater = (gint64)(budget * MEMORY_BUDGET_LOW_WATER);
+  for (int i = 0; i < MEMORY_POOL_COUNT; i++) {
+    g_mutex_lock(&budgetMutex);
+    gint64 excess = totalUsed - lowWater;
+    gint64 before = pools[i].used;
+    memory_evict_callback_t evict = pools[i].evict;
+    gpointer evictData = pools[i].data;
+    if (excess <= 0) {
+      evictionIdle = 0;
+      g_mutex_unlock(&budgetMutex);
+      return G_SOURCE_REMOVE;
+    }
+    g_mutex_unlock(&budgetMutex);
+    // evictors take their own locks and release through memory_budget_release
+    if (evict && before > 0) {
+      evict(excess, evictData);
+      TRACE_COUNT(pools[i].name, before - memory_budget_get_used(i));
+    }
+  }
+  g_mutex_lock(&budgetMutex);
+  if (totalUsed > budget) {
+    g_print("Memory budget exceeded by %" G_GINT64_FORMAT " KB after eviction\n", (totalUsed - budget) / 1024);
+  }
+  evictionIdle = 0;
+  g_mutex_unlock(&budgetMutex);
+  return G_SOURCE_REMOVE;
+}
+
+/* accounts bytes kept by pool, eviction is scheduled on the main loop when over budget */
+void memory_budget_charge(memory_pool_t pool, gint64 bytes) {
+  g_mutex_lock(&budgetMutex);
+  pools[pool].used += bytes;
+  totalUsed += bytes;
+  if (totalUsed > budget && 0 == evictionIdle) {
+    evictionIdle = g_idle_add(run_eviction, NULL);
+  }
+  g_mutex_unlock(&budgetMutex);
+}
+
+void memory_budget_release(memory_pool_t pool, gint64 bytes) {
+  g_mutex_lock(&budgetMutex);
+  pools[pool].used -= bytes;
+  totalUsed -= bytes;
+  g_mutex_unlock(&budgetMutex);
+}
+
+gint64 memory_budget_get_used(memory_pool_t pool) {
+  g_mutex_lock(&budgetMutex);
+  gint64 used = pools[pool].used;
+  g_mutex_unlock(&budgetMutex);
+  return used;
+}
+
+/* TRUE when work that only fills caches ahead of time should be skipped */
+gboolean memory_budget_is_tight() {
+  g_mutex_lock(&budgetMutex);
+  gboolean tight = totalUsed > budget * MEMORY_BUDGET_TIGHT;
+  g_mutex_unlock(&budgetMutex);
+  return tight;
+}
+
+gint64 memory_get_surface_bytes(cairo_surface_t* surface) {
+  return (gint64)cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+}
+
+gint64 memory_get_pixbuf_bytes(GdkPixbuf* pixbuf) {
+  return (gint64)gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
+}
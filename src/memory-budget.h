@@ -0,0 +1,35 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <gtk/gtk.h>
+
+/*
+ * One memory budget for the caches of all subsystems. Each cache charges what
+ * it keeps and releases it again when dropped. Above the budget, the caches
+ * are asked on the main loop to evict, cheapest to rebuild first, until usage
+ * is back below the low water mark.
+ */
+
+typedef enum {
+  MEMORY_POOL_PDF_PAGES, // rendered and prerendered PDF pages
+  MEMORY_POOL_TILES, // tiles of large pages
+  MEMORY_POOL_THUMBNAILS, // decoded thumbnails in memory
+  MEMORY_POOL_FILES, // contents of files read from removable devices
+  MEMORY_POOL_PREVIEWS, // the current picture, its edits and display copy
+  MEMORY_POOL_PRINT_PAGES, // encoded print pages waiting for the spool file, not evictable
+  MEMORY_POOL_COUNT
+} memory_pool_t;
+
+/* frees at least bytes of the pool if it can, runs on the main thread */
+typedef void(*memory_evict_callback_t)(gint64 bytes, gpointer data);
+
+void memory_budget_init();
+void memory_budget_set_evictor(memory_pool_t pool, memory_evict_callback_t evict, gpointer data);
+void memory_budget_charge(memory_pool_t pool, gint64 bytes);
+void memory_budget_release(memory_pool_t pool, gint64 bytes);
+gint64 memory_budget_get_used(memory_pool_t pool);
+gboolean memory_budget_is_tight();
+gint64 memory_get_surface_bytes(cairo_surface_t* surface);
+gint64 memory_get_pixbuf_bytes(GdkPixbuf* pixbuf);
+
+#endif
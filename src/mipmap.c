@@ -0,0 +1,94 @@
+#include "mipmap.h"
+
+#define MIPMAP_MIN_SIZE 256 // no levels below this size, cairo handles the rest
+
+struct mipmap {
+  GPtrArray* levels; // cairo_surface_t, the base first, each half the size of the one before
+  double width; // picture units the pyramid is drawn in
+  double height;
+};
+
+/* 2x2 box filter, odd edges repeat their last row or column */
+static cairo_surface_t* downsample(cairo_surface_t* source) {
+  int width = cairo_image_surface_get_width(source);
+  int height = cairo_image_surface_get_height(source);
+  int stride = cairo_image_surface_get_stride(source);
+  cairo_format_t format = cairo_image_surface_get_format(source);
+  int halfWidth = (width + 1) / 2, halfHeight = (height + 1) / 2;
+
+  cairo_surface_t* result = cairo_image_surface_create(format, halfWidth, halfHeight);
+  int resultStride = cairo_image_surface_get_stride(result);
+  cairo_surface_flush(source);
+  unsigned char* src = cairo_image_surface_get_data(source);
+  unsigned char* dst = cairo_image_surface_get_data(result);
+
+  for (int y = 0; y < halfHeight; y++) {
+    unsigned char* row0 = src + (2 * y) * stride;
+    unsigned char* row1 = src + MIN(2 * y + 1, height - 1) * stride;
+    unsigned char* out = dst + y * resultStride;
+    for (int x = 0; x < halfWidth; x++) {
+      int x0 = 2 * x * 4, x1 = MIN(2 * x + 1, width - 1) * 4;
+      for (int c = 0; c < 4; c++) {
+        out[x * 4 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+      }
+    }
+  }
+  cairo_surface_mark_dirty(result);
+  return result;
+}
+
+/* builds all levels from base right away, call on a worker thread for large pictures */
+mipmap_t* mipmap_new(cairo_surface_t* base, double width, double height) {
+  mipmap_t* mipmap = (mipmap_t*)g_malloc0(sizeof(mipmap_t));
+  mipmap->levels = g_ptr_array_new_with_free_func((GDestroyNotify)cairo_surface_destroy);
+  mipmap->width = width;
+  mipmap->height = height;
+  g_ptr_array_add(mipmap->levels, cairo_surface_reference(base));
+  cairo_surface_t* level = base;
+  while (MAX(cairo_image_surface_get_width(level), cairo_image_surface_get_height(level)) > MIPMAP_MIN_SIZE) {
+    level = downsample(level);
+    g_ptr_array_add(mipmap->levels, level);
+  }
+  return mipmap;
+}
+
+void mipmap_free(mipmap_t* mipmap) {
+  g_ptr_array_free(mipmap->levels, TRUE);
+  g_free(mipmap);
+}
+
+gint64 mipmap_get_bytes(mipmap_t* mipmap) {
+  gint64 bytes = 0;
+  for (guint i = 0; i < mipmap->levels->len; i++) {
+    cairo_surface_t* level = g_ptr_array_index(mipmap->levels, i);
+    bytes += (gint64)cairo_image_surface_get_stride(level) * cairo_image_surface_get_height(level);
+  }
+  return bytes;
+}
+
+/* draws the picture with its origin at x, y, scale is device pixels per picture unit */
+void mipmap_draw(mipmap_t* mipmap, cairo_t* cr, double scale, double x, double y) {
+  double shownWidth = mipmap->width * scale;
+  // the smallest level that still has a pixel for every device pixel
+  cairo_surface_t* level = g_ptr_array_index(mipmap->levels, 0);
+  for (guint i = 1; i < mipmap->levels->len; i++) {
+    cairo_surface_t* candidate = g_ptr_array_index(mipmap->levels, i);
+    if (cairo_image_surface_get_width(candidate) < shownWidth) {
+      break;
+    }
+    level = candidate;
+  }
+  int levelWidth = cairo_image_surface_get_width(level);
+  int levelHeight = cairo_image_surface_get_height(level);
+
+  cairo_save(cr);
+  cairo_translate(cr, x, y);
+  cairo_scale(cr, shownWidth / levelWidth, mipmap->height * scale / levelHeight);
+  cairo_set_source_surface(cr, level, 0, 0);
+  // at most 2:1 from the chosen level, bilinear is enough
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+  cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+  cairo_rectangle(cr, 0, 0, levelWidth, levelHeight);
+  cairo_fill(cr);
+  cairo_restore(cr);
+}
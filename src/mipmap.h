@@ -0,0 +1,19 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Power-of-two pyramid of a picture. Every zoom level is drawn from the
+ * nearest level that is at least as large, so a draw never samples more than
+ * twice the pixels it shows.
+ */
+
+typedef struct mipmap mipmap_t;
+
+mipmap_t* mipmap_new(cairo_surface_t* base, double width, double height);
+void mipmap_free(mipmap_t* mipmap);
+gint64 mipmap_get_bytes(mipmap_t* mipmap);
+void mipmap_draw(mipmap_t* mipmap, cairo_t* cr, double scale, double x, double y);
+
+#endif
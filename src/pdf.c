@@ -1,92 +1,592 @@
+#include <math.h>
+
 #include "pdf.h"
+#include "tiles.h"
+#include "file-map.h"
+#include "trace.h"
+#include "memory-budget.h"
+
+#define PDF_PRERENDER_PAGES 1
+#define PDF_LARGE_PAGE_AREA (842.0 * 1191.0) // pages above A3 are shown tiled
+#define PDF_MAX_TILES 96
+#define PDF_THUMBNAIL_SIZE 96 // longest side of a page in the overview strip
+#define PDF_THUMBNAIL_BATCH 8 // pages rendered before the strip is redrawn
+#define PDF_STRIP_COLUMNS 2
+#define PDF_STRIP_CELL_WIDTH 100
+#define PDF_STRIP_CELL_HEIGHT 116 // thumbnail and page number
+#define PDF_STRIP_HEIGHT 480
 
 typedef struct {
+  gint refCount; // held by the UI and by each queued prerender job
+  gboolean closed;
+  char* filename;
   int page;
   int page_count;
   PopplerDocument* doc;
+  PopplerDocument* renderDoc; // separate handle for the prerender thread
+  GThreadPool* prerenderPool;
+  GMutex cacheMutex;
+  GHashTable* pages; // page number -> cairo_surface_t
+  GQueue pageOrder; // most recently used page first
+  guint cacheSize;
   cairo_surface_t* surface;
-  int width;
+  int width; // preview viewport
   int height;
   void(*on_render)(gpointer, int, int); // render request callback
+  void(*on_render_tiled)(gpointer); // render request callback for large pages
   GtkWidget* page_label;
+  cairo_surface_t** thumbnails; // page overview by page number, NULL until rendered, guarded by cacheMutex
+  GThreadPool* thumbnailPool; // one thread, created with the strip
+  PopplerDocument* thumbnailDoc; // separate handle for the thumbnail thread
+  gboolean thumbnailsQueued; // a batch job is queued or running
+  int visibleFirst; // pages in the strip viewport, rendered first
+  int visibleLast;
+  GtkWidget* strip; // the latest page overview, NULL once destroyed
 } document_page_t;
 
+typedef struct {
+  char* filename;
+  int page;
+  PopplerDocument* doc; // opened on the tile thread
+} pdf_tile_source_t;
+
+typedef struct {
+  char* filename;
+  int firstPage;
+  int pageCount;
+  PopplerDocument* doc; // opened on the print thread
+} pdf_print_source_t;
+
 static document_page_t* currentDocument = NULL;
 
+static int prerenderPages = PDF_PRERENDER_PAGES;
+
+/* every handle of a file parses the same session mapping, or for files on sticks the same read copy */
+static PopplerDocument* open_document(char* filename, GError** error) {
+  GBytes* bytes = file_map_get(filename, error);
+  if (NULL == bytes) {
+    return NULL;
+  }
+  PopplerDocument* doc = poppler_document_new_from_bytes(bytes, NULL, error);
+  g_bytes_unref(bytes);
+  return doc;
+}
+
+static void unref_doc(document_page_t* doc_page) {
+  if (!g_atomic_int_dec_and_test(&doc_page->refCount)) {
+    return;
+  }
+  g_print("Free doc\n");
+  g_object_unref(doc_page->doc);
+  if (doc_page->renderDoc) {
+    g_object_unref(doc_page->renderDoc);
+  }
+  if (doc_page->surface) {
+    cairo_surface_destroy(doc_page->surface);
+  }
+  if (doc_page->thumbnailDoc) {
+    g_object_unref(doc_page->thumbnailDoc);
+  }
+  for (int i = 0; i < doc_page->page_count; i++) {
+    if (doc_page->thumbnails[i]) {
+      memory_budget_release(MEMORY_POOL_PDF_PAGES, memory_get_surface_bytes(doc_page->thumbnails[i]));
+      cairo_surface_destroy(doc_page->thumbnails[i]);
+    }
+  }
+  g_free(doc_page->thumbnails);
+  g_hash_table_destroy(doc_page->pages);
+  g_queue_clear(&doc_page->pageOrder);
+  g_mutex_clear(&doc_page->cacheMutex);
+  g_free(doc_page->filename);
+  g_free(doc_page);
+}
+
 static void free_doc() {
-  g_print("Free doc");
-  g_object_unref(currentDocument->doc);
-  cairo_surface_destroy(currentDocument->surface);
-  g_free(currentDocument);
+  g_atomic_int_set(&currentDocument->closed, TRUE);
+  // queued prerender jobs see the closed flag and only drop their reference
+  g_thread_pool_free(currentDocument->prerenderPool, FALSE, FALSE);
+  if (currentDocument->thumbnailPool) {
+    g_thread_pool_free(currentDocument->thumbnailPool, FALSE, FALSE);
+    currentDocument->thumbnailPool = NULL;
+  }
+  unref_doc(currentDocument);
+  currentDocument = NULL;
+}
+
+/* closes the open document, e.g. when its device is removed, toolbars keep their own reference */
+void close_pdf_document() {
+  if (currentDocument) {
+    free_doc();
+  }
 }
 
-static void render_pdf_page(
+/* points per inch of PDF user space */
+#define PDF_POINTS_PER_INCH 72.0
+
+/* dpi > 0 renders at that resolution, otherwise the page is fitted into the viewport */
+static double get_page_scale(PopplerPage* page, double dpi, int viewportWidth, int viewportHeight) {
+  double pageWidth, pageHeight;
+  poppler_page_get_size(page, &pageWidth, &pageHeight);
+  if (dpi > 0) {
+    return dpi / PDF_POINTS_PER_INCH;
+  }
+  return MIN(viewportWidth / pageWidth, viewportHeight / pageHeight);
+}
+
+static cairo_surface_t* render_pdf_page(
   PopplerDocument* doc, 
   int n_page, 
-  cairo_surface_t* surface, 
-  int width, int height
+  double dpi,
+  int viewportWidth, int viewportHeight
 ) {
+  TRACE_SCOPE("render_pdf_page");
   PopplerPage* page = poppler_document_get_page(doc, n_page);
+  if (NULL == page) {
+    return NULL;
+  }
+  double pageWidth, pageHeight;
+  poppler_page_get_size(page, &pageWidth, &pageHeight);
+  double scale = get_page_scale(page, dpi, viewportWidth, viewportHeight);
+  int width = MAX(1, (int)ceil(pageWidth * scale));
+  int height = MAX(1, (int)ceil(pageHeight * scale));
+
+  cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
   cairo_t* cr = cairo_create(surface);
-  cairo_rectangle(cr, 0, 0, width, height);
   cairo_set_source_rgb(cr, 1, 1, 1);
-  cairo_fill(cr);
   cairo_paint(cr);
+  cairo_scale(cr, scale, scale);
   poppler_page_render(page, cr);
   g_object_unref(page);
   cairo_destroy(cr);
+  return surface;
 }
 
-cairo_surface_t* get_pdf_cairo_surface(char* filename, int n_page, int width, int height) {
-  if (NULL != currentDocument) {
-    free_doc(); 
+/* returns a new reference to a cached page or NULL */
+static cairo_surface_t* get_cached_page(document_page_t* doc_page, int n_page) {
+  g_mutex_lock(&doc_page->cacheMutex);
+  cairo_surface_t* surface = g_hash_table_lookup(doc_page->pages, GINT_TO_POINTER(n_page));
+  if (surface) {
+    g_queue_remove(&doc_page->pageOrder, GINT_TO_POINTER(n_page));
+    g_queue_push_head(&doc_page->pageOrder, GINT_TO_POINTER(n_page));
+    cairo_surface_reference(surface);
   }
-  PopplerDocument* doc;
-  GError* err = NULL;
-  
-  gchar* uri = g_strconcat("file:", filename, NULL);
-  
-  doc = poppler_document_new_from_file(uri, NULL, &err);
-  
-  if (NULL != err) {
-    g_print(err->message);
+  g_mutex_unlock(&doc_page->cacheMutex);
+  return surface;
+}
+
+/* value destroy function of the page cache */
+static void release_cached_page(cairo_surface_t* surface) {
+  memory_budget_release(MEMORY_POOL_PDF_PAGES, memory_get_surface_bytes(surface));
+  cairo_surface_destroy(surface);
+}
+
+static void put_cached_page(document_page_t* doc_page, int n_page, cairo_surface_t* surface) {
+  g_mutex_lock(&doc_page->cacheMutex);
+  if (!g_hash_table_contains(doc_page->pages, GINT_TO_POINTER(n_page))) {
+    memory_budget_charge(MEMORY_POOL_PDF_PAGES, memory_get_surface_bytes(surface));
+    g_hash_table_insert(doc_page->pages, GINT_TO_POINTER(n_page), cairo_surface_reference(surface));
+    g_queue_push_head(&doc_page->pageOrder, GINT_TO_POINTER(n_page));
+    while (doc_page->pageOrder.length > doc_page->cacheSize) {
+      g_hash_table_remove(doc_page->pages, g_queue_pop_tail(&doc_page->pageOrder));
+    }
+  }
+  g_mutex_unlock(&doc_page->cacheMutex);
+}
+
+/* called with cacheMutex held, the strip asks for dropped thumbnails again when they scroll into view */
+static gint64 evict_thumbnails(document_page_t* doc_page, gint64 bytes) {
+  gint64 freed = 0;
+  int first = doc_page->visibleFirst;
+  int last = doc_page->visibleLast;
+  // farthest from the strip viewport first
+  for (int distance = doc_page->page_count; distance > 0 && freed < bytes; distance--) {
+    int candidates[2] = { last + distance, first - distance };
+    for (int i = 0; i < 2; i++) {
+      int page = candidates[i];
+      if (page < 0 || page >= doc_page->page_count || NULL == doc_page->thumbnails[page]) {
+        continue;
+      }
+      gint64 size = memory_get_surface_bytes(doc_page->thumbnails[page]);
+      memory_budget_release(MEMORY_POOL_PDF_PAGES, size);
+      cairo_surface_destroy(doc_page->thumbnails[page]);
+      doc_page->thumbnails[page] = NULL;
+      freed += size;
+    }
+  }
+  return freed;
+}
+
+/* drops cached pages other than the current one, least recently used first, then thumbnails out of view */
+static void evict_cached_pages(gint64 bytes, gpointer data) {
+  document_page_t* doc_page = currentDocument;
+  if (NULL == doc_page) {
+    return;
+  }
+  g_mutex_lock(&doc_page->cacheMutex);
+  gint64 freed = 0;
+  GList* link = doc_page->pageOrder.tail;
+  while (link && freed < bytes) {
+    GList* prev = link->prev;
+    if (GPOINTER_TO_INT(link->data) != doc_page->page) {
+      freed += memory_get_surface_bytes(g_hash_table_lookup(doc_page->pages, link->data));
+      g_hash_table_remove(doc_page->pages, link->data);
+      g_queue_delete_link(&doc_page->pageOrder, link);
+    }
+    link = prev;
+  }
+  if (freed < bytes) {
+    evict_thumbnails(doc_page, bytes - freed);
+  }
+  g_mutex_unlock(&doc_page->cacheMutex);
+}
+
+static cairo_surface_t* create_page_surface(document_page_t* doc_page, PopplerDocument* doc, int n_page) {
+  return render_pdf_page(doc, n_page, 0, doc_page->width, doc_page->height);
+}
+
+static void prerender_page(gpointer data, gpointer user_data) {
+  document_page_t* doc_page = (document_page_t*)user_data;
+  int n_page = GPOINTER_TO_INT(data) - 1;
+  cairo_surface_t* cached = NULL;
+
+  if (!g_atomic_int_get(&doc_page->closed) && NULL == (cached = get_cached_page(doc_page, n_page))) {
+    if (NULL == doc_page->renderDoc) {
+      doc_page->renderDoc = open_document(doc_page->filename, NULL);
+    }
+    if (doc_page->renderDoc) {
+      cairo_surface_t* surface = create_page_surface(doc_page, doc_page->renderDoc, n_page);
+      if (surface) {
+        put_cached_page(doc_page, n_page, surface);
+        cairo_surface_destroy(surface);
+      }
+    }
+  }
+  if (cached) {
+    cairo_surface_destroy(cached);
+  }
+  unref_doc(doc_page);
+}
+
+/* queues the pages around the current one for background rendering, unless memory is short */
+static void prerender_neighbours(document_page_t* doc_page) {
+  if (memory_budget_is_tight()) {
+    return;
+  }
+  for (int distance = 1; distance <= prerenderPages; distance++) {
+    int candidates[2] = { doc_page->page + distance, doc_page->page - distance };
+    for (int i = 0; i < 2; i++) {
+      if (candidates[i] < 0 || candidates[i] >= doc_page->page_count) {
+        continue;
+      }
+      g_atomic_int_inc(&doc_page->refCount);
+      // page numbers are offset by one, NULL cannot be pushed
+      g_thread_pool_push(doc_page->prerenderPool, GINT_TO_POINTER(candidates[i] + 1), NULL);
+    }
+  }
+}
+
+/* the embedded thumbnail if the document has one, a render fitted into width x height otherwise */
+static cairo_surface_t* render_page_thumbnail(PopplerDocument* doc, int n_page, int width, int height) {
+  PopplerPage* page = poppler_document_get_page(doc, n_page);
+  if (NULL == page) {
     return NULL;
   }
-  
-  cairo_surface_t* result = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
-  render_pdf_page(doc, n_page, result, width, height);
+  cairo_surface_t* result = poppler_page_get_thumbnail(page);
+  g_object_unref(page);
+  if (NULL == result) {
+    result = render_pdf_page(doc, n_page, 0, width, height);
+  }
+  return result;
+}
+
+/*
+ * Called with cacheMutex held: the first missing page in the viewport, then
+ * outwards from it. With memory short only the viewport is rendered, so
+ * evicted thumbnails are not rendered again right away.
+ */
+static int get_next_thumbnail_page(document_page_t* doc_page) {
+  int first = CLAMP(doc_page->visibleFirst, 0, doc_page->page_count - 1);
+  int last = CLAMP(doc_page->visibleLast, first, doc_page->page_count - 1);
+  for (int page = first; page <= last; page++) {
+    if (NULL == doc_page->thumbnails[page]) {
+      return page;
+    }
+  }
+  if (memory_budget_is_tight()) {
+    return -1;
+  }
+  for (int distance = 1; first - distance >= 0 || last + distance < doc_page->page_count; distance++) {
+    if (last + distance < doc_page->page_count && NULL == doc_page->thumbnails[last + distance]) {
+      return last + distance;
+    }
+    if (first - distance >= 0 && NULL == doc_page->thumbnails[first - distance]) {
+      return first - distance;
+    }
+  }
+  return -1;
+}
+
+static gboolean notify_thumbnails(gpointer data) {
+  document_page_t* doc_page = (document_page_t*)data;
+  if (!g_atomic_int_get(&doc_page->closed) && doc_page->strip) {
+    gtk_widget_queue_draw(doc_page->strip);
+  }
+  unref_doc(doc_page);
+  return G_SOURCE_REMOVE;
+}
 
-  currentDocument = (document_page_t*)g_malloc(sizeof(document_page_t));
-  currentDocument->doc = doc;
+/* renders page thumbnails until all are done, the strip is redrawn after every batch */
+static void render_thumbnails(gpointer data, gpointer user_data) {
+  document_page_t* doc_page = (document_page_t*)user_data;
+  if (NULL == doc_page->thumbnailDoc) {
+    doc_page->thumbnailDoc = open_document(doc_page->filename, NULL);
+  }
+  int rendered = 0;
+  while (!g_atomic_int_get(&doc_page->closed) && doc_page->thumbnailDoc) {
+    g_mutex_lock(&doc_page->cacheMutex);
+    int page = get_next_thumbnail_page(doc_page);
+    g_mutex_unlock(&doc_page->cacheMutex);
+    if (page < 0) {
+      break;
+    }
+    TRACE_SCOPE("render_page_thumbnail");
+    cairo_surface_t* thumbnail = render_page_thumbnail(doc_page->thumbnailDoc, page, PDF_THUMBNAIL_SIZE, PDF_THUMBNAIL_SIZE);
+    if (NULL == thumbnail) {
+      // a broken page gets an empty thumbnail, so it is not tried again
+      thumbnail = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, 1);
+    }
+    memory_budget_charge(MEMORY_POOL_PDF_PAGES, memory_get_surface_bytes(thumbnail));
+    g_mutex_lock(&doc_page->cacheMutex);
+    doc_page->thumbnails[page] = thumbnail;
+    g_mutex_unlock(&doc_page->cacheMutex);
+    if (++rendered % PDF_THUMBNAIL_BATCH == 0) {
+      g_atomic_int_inc(&doc_page->refCount);
+      g_idle_add(notify_thumbnails, doc_page);
+    }
+  }
+  g_mutex_lock(&doc_page->cacheMutex);
+  doc_page->thumbnailsQueued = FALSE;
+  g_mutex_unlock(&doc_page->cacheMutex);
+  // the last partial batch
+  g_atomic_int_inc(&doc_page->refCount);
+  g_idle_add(notify_thumbnails, doc_page);
+  unref_doc(doc_page);
+}
+
+/* makes the pages first..last the next ones to render and starts the thumbnail thread if it is idle */
+static void request_thumbnails(document_page_t* doc_page, int first, int last) {
+  if (NULL == doc_page->thumbnailPool) {
+    doc_page->thumbnailPool = g_thread_pool_new(render_thumbnails, doc_page, 1, FALSE, NULL);
+  }
+  g_mutex_lock(&doc_page->cacheMutex);
+  doc_page->visibleFirst = first;
+  doc_page->visibleLast = last;
+  gboolean start = !doc_page->thumbnailsQueued && get_next_thumbnail_page(doc_page) >= 0;
+  if (start) {
+    doc_page->thumbnailsQueued = TRUE;
+  }
+  g_mutex_unlock(&doc_page->cacheMutex);
+  if (start) {
+    g_atomic_int_inc(&doc_page->refCount);
+    // the pool passes data to the job, which must not be NULL
+    g_thread_pool_push(doc_page->thumbnailPool, GINT_TO_POINTER(1), NULL);
+  }
+}
+
+static cairo_surface_t* get_page_surface(document_page_t* doc_page, int n_page) {
+  cairo_surface_t* surface = get_cached_page(doc_page, n_page);
+  if (NULL == surface) {
+    surface = create_page_surface(doc_page, doc_page->doc, n_page);
+    if (NULL == surface) {
+      return NULL;
+    }
+    put_cached_page(doc_page, n_page, surface);
+  }
+  if (doc_page->surface) {
+    cairo_surface_destroy(doc_page->surface);
+  }
+  doc_page->surface = surface;
+  prerender_neighbours(doc_page);
+  return surface;
+}
+
+/* number of pages rendered ahead and behind the current page */
+void set_pdf_prerender_pages(int pages) {
+  prerenderPages = MAX(0, pages);
+}
+
+/* opens a document for the preview area of width x height, reusing the open one */
+gboolean open_pdf_document(char* filename, int width, int height) {
+  if (NULL != currentDocument && (g_strcmp0(currentDocument->filename, filename) != 0 || currentDocument->width != width || currentDocument->height != height)) {
+    free_doc(); 
+  }
+  if (NULL == currentDocument) {
+    PopplerDocument* doc;
+    GError* err = NULL;
+    
+    doc = open_document(filename, &err);
+    
+    if (NULL != err) {
+      g_print(err->message);
+      g_error_free(err);
+      return FALSE;
+    }
+
+    currentDocument = (document_page_t*)g_malloc0(sizeof(document_page_t));
+    currentDocument->refCount = 1;
+    currentDocument->filename = g_strdup(filename);
+    currentDocument->doc = doc;
+    currentDocument->page_count = poppler_document_get_n_pages(doc);
+    currentDocument->width = width;
+    currentDocument->height = height;
+    currentDocument->cacheSize = 2 * prerenderPages + 3;
+    currentDocument->thumbnails = g_new0(cairo_surface_t*, MAX(1, currentDocument->page_count));
+    currentDocument->pages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)release_cached_page);
+    g_mutex_init(&currentDocument->cacheMutex);
+    currentDocument->prerenderPool = g_thread_pool_new(prerender_page, currentDocument, 1, FALSE, NULL);
+    memory_budget_set_evictor(MEMORY_POOL_PDF_PAGES, evict_cached_pages, NULL);
+  }
   currentDocument->page = 0;
-  currentDocument->page_count = poppler_document_get_n_pages(doc);
-  currentDocument->surface = result;
-  currentDocument->width = width;
-  currentDocument->height = height;
+  return TRUE;
+}
+
+/* renders a page fitted into width x height, the surface is owned by the document */
+cairo_surface_t* get_pdf_cairo_surface(char* filename, int n_page, int width, int height) {
+  if (!open_pdf_document(filename, width, height)) {
+    return NULL;
+  }
+  currentDocument->page = n_page;
   
-  return result;
+  return get_page_surface(currentDocument, n_page);
+}
+
+static void free_pdf_tile_source(pdf_tile_source_t* source) {
+  if (source->doc) {
+    g_object_unref(source->doc);
+  }
+  g_free(source->filename);
+  g_free(source);
+}
+
+static void render_pdf_tile(pdf_tile_source_t* source, cairo_t* cr, double scale) {
+  if (NULL == source->doc) {
+    source->doc = open_document(source->filename, NULL);
+  }
+  PopplerPage* page = source->doc ? poppler_document_get_page(source->doc, source->page) : NULL;
+  if (NULL == page) {
+    return;
+  }
+  cairo_scale(cr, scale, scale);
+  poppler_page_render(page, cr);
+  g_object_unref(page);
+}
+
+static gboolean is_large_page(PopplerDocument* doc, int n_page) {
+  double pageWidth, pageHeight;
+  PopplerPage* page = poppler_document_get_page(doc, n_page);
+  if (NULL == page) {
+    return FALSE;
+  }
+  poppler_page_get_size(page, &pageWidth, &pageHeight);
+  g_object_unref(page);
+  return pageWidth * pageHeight > PDF_LARGE_PAGE_AREA;
+}
+
+/* a tiled view of a page of the open document, sized in points */
+tile_view_t* get_pdf_tile_view(int n_page) {
+  double pageWidth, pageHeight;
+  PopplerPage* page = currentDocument ? poppler_document_get_page(currentDocument->doc, n_page) : NULL;
+  if (NULL == page) {
+    return NULL;
+  }
+  poppler_page_get_size(page, &pageWidth, &pageHeight);
+  g_object_unref(page);
+
+  pdf_tile_source_t* source = (pdf_tile_source_t*)g_malloc0(sizeof(pdf_tile_source_t));
+  source->filename = g_strdup(currentDocument->filename);
+  source->page = n_page;
+  return tile_view_new((tile_render_func_t)render_pdf_tile, source, (GDestroyNotify)free_pdf_tile_source, pageWidth, pageHeight, PDF_MAX_TILES);
+}
+
+static void free_pdf_print_source(pdf_print_source_t* source) {
+  if (source->doc) {
+    g_object_unref(source->doc);
+  }
+  g_free(source->filename);
+  g_free(source);
+}
+
+static PopplerPage* get_print_page(pdf_print_source_t* source, int page) {
+  if (NULL == source->doc) {
+    source->doc = open_document(source->filename, NULL);
+  }
+  return source->doc ? poppler_document_get_page(source->doc, source->firstPage + page) : NULL;
+}
+
+/* each print worker parses the document itself, Poppler documents are not shared between threads */
+static pdf_print_source_t* copy_pdf_print_source(pdf_print_source_t* source) {
+  pdf_print_source_t* copy = (pdf_print_source_t*)g_malloc0(sizeof(pdf_print_source_t));
+  copy->filename = g_strdup(source->filename);
+  copy->firstPage = source->firstPage;
+  copy->pageCount = source->pageCount;
+  return copy;
+}
+
+static int get_pdf_print_page_count(pdf_print_source_t* source) {
+  return source->pageCount;
+}
+
+static void get_pdf_print_page_size(pdf_print_source_t* source, int page, double* width, double* height) {
+  PopplerPage* pdfPage = get_print_page(source, page);
+  *width = PRINT_A4_WIDTH;
+  *height = PRINT_A4_HEIGHT;
+  if (pdfPage) {
+    poppler_page_get_size(pdfPage, width, height);
+    g_object_unref(pdfPage);
+  }
+}
+
+static void render_pdf_print_page(pdf_print_source_t* source, int page, cairo_t* cr) {
+  PopplerPage* pdfPage = get_print_page(source, page);
+  if (pdfPage) {
+    poppler_page_render_for_printing(pdfPage, cr);
+    g_object_unref(pdfPage);
+  }
+}
+
+/* pages firstPage to lastPage of the open document for a print job, with its own document handle */
+print_source_t* get_pdf_print_source(int firstPage, int lastPage) {
+  if (NULL == currentDocument || currentDocument->page_count <= 0) {
+    return NULL;
+  }
+  firstPage = CLAMP(firstPage, 0, currentDocument->page_count - 1);
+  lastPage = CLAMP(lastPage, firstPage, currentDocument->page_count - 1);
+  pdf_print_source_t* data = (pdf_print_source_t*)g_malloc0(sizeof(pdf_print_source_t));
+  data->filename = g_strdup(currentDocument->filename);
+  data->firstPage = firstPage;
+  data->pageCount = lastPage - firstPage + 1;
+
+  print_source_t* source = print_source_new(data, (GDestroyNotify)free_pdf_print_source);
+  source->get_page_count = (int(*)(gpointer))get_pdf_print_page_count;
+  source->get_page_size = (void(*)(gpointer, int, double*, double*))get_pdf_print_page_size;
+  source->render = (void(*)(gpointer, int, cairo_t*))render_pdf_print_page;
+  source->copy = (gpointer(*)(gpointer))copy_pdf_print_source;
+  return source;
 }
 
 cairo_surface_t* get_pdf_thumbnail_cairo_surface(char* filename, int width, int height) {
+  TRACE_SCOPE("get_pdf_thumbnail_cairo_surface");
   PopplerDocument* doc;
   GError* err = NULL;
-  g_print("Thumbnail %s\n", filename);
-  gchar* uri = g_strconcat("file:", filename, NULL);
-  
-  doc = poppler_document_new_from_file(uri, NULL, &err);
+  doc = open_document(filename, &err);
   
   if (NULL != err) {
     g_print(err->message);
+    g_error_free(err);
     return NULL;
   }
-  PopplerPage* page = poppler_document_get_page(doc, 0);
-  cairo_surface_t* result = poppler_page_get_thumbnail(page);
-  if (NULL == result) {
-    result = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
-    render_pdf_page(doc, 0, result, width, height);
-  }
+  cairo_surface_t* result = render_page_thumbnail(doc, 0, width, height);
   g_object_unref(doc);
-  g_object_unref(page);
   return result;
 }
 
@@ -98,16 +598,171 @@ static void get_page_label_text(GtkWidget* label, document_page_t* doc_page) {
 }
 
 static void render_doc_page(document_page_t* doc_page) {
-  render_pdf_page(doc_page->doc, doc_page->page, doc_page->surface, doc_page->width, doc_page->height);
-  doc_page->on_render(doc_page->surface, doc_page->width, doc_page->height);
+  if (doc_page->on_render_tiled && is_large_page(doc_page->doc, doc_page->page)) {
+    // posters and plans are rendered progressively in tiles instead of in one pass
+    doc_page->on_render_tiled(get_pdf_tile_view(doc_page->page));
+    get_page_label_text(doc_page->page_label, doc_page);
+    return;
+  }
+  if (NULL == get_page_surface(doc_page, doc_page->page)) {
+    doc_page->on_render(NULL, 0, 0);
+    return;
+  }
+  doc_page->on_render(doc_page->surface, cairo_image_surface_get_width(doc_page->surface), cairo_image_surface_get_height(doc_page->surface));
   get_page_label_text(doc_page->page_label, doc_page);
 }
 
+/* scroll position of a strip in pixels */
+static GtkAdjustment* get_strip_adjustment(GtkWidget* strip) {
+  return GTK_ADJUSTMENT(g_object_get_data(G_OBJECT(strip), "adjustment"));
+}
+
+/* keeps the current page in view and highlighted in the strip */
+static void update_strip(document_page_t* doc_page) {
+  if (NULL == doc_page->strip) {
+    return;
+  }
+  double top = (doc_page->page / PDF_STRIP_COLUMNS) * PDF_STRIP_CELL_HEIGHT;
+  gtk_adjustment_clamp_page(get_strip_adjustment(doc_page->strip), top, top + PDF_STRIP_CELL_HEIGHT);
+  gtk_widget_queue_draw(doc_page->strip);
+}
+
+static void draw_strip_cell(cairo_t* cr, document_page_t* doc_page, int page, cairo_surface_t* thumbnail) {
+  double x = (page % PDF_STRIP_COLUMNS) * PDF_STRIP_CELL_WIDTH;
+  double y = (page / PDF_STRIP_COLUMNS) * PDF_STRIP_CELL_HEIGHT;
+  double left = x + (PDF_STRIP_CELL_WIDTH - PDF_THUMBNAIL_SIZE) / 2.0;
+  double top = y + 2;
+  if (NULL == thumbnail) {
+    // still rendering
+    cairo_set_source_rgb(cr, 0.3, 0.3, 0.3);
+    cairo_rectangle(cr, left, top, PDF_THUMBNAIL_SIZE, PDF_THUMBNAIL_SIZE);
+    cairo_fill(cr);
+  } else {
+    int width = cairo_image_surface_get_width(thumbnail);
+    int height = cairo_image_surface_get_height(thumbnail);
+    // embedded thumbnails come in any size
+    double scale = MIN((double)PDF_THUMBNAIL_SIZE / width, (double)PDF_THUMBNAIL_SIZE / height);
+    cairo_save(cr);
+    cairo_translate(cr, left + (PDF_THUMBNAIL_SIZE - width * scale) / 2, top + (PDF_THUMBNAIL_SIZE - height * scale) / 2);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, thumbnail, 0, 0);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  }
+  if (page == doc_page->page) {
+    cairo_set_source_rgb(cr, 0.2, 0.5, 1.0);
+    cairo_set_line_width(cr, 3);
+    cairo_rectangle(cr, left - 1.5, top - 1.5, PDF_THUMBNAIL_SIZE + 3, PDF_THUMBNAIL_SIZE + 3);
+    cairo_stroke(cr);
+  }
+  gchar* number = g_strdup_printf("%i", page + 1);
+  cairo_text_extents_t extents;
+  cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+  cairo_set_font_size(cr, 11);
+  cairo_text_extents(cr, number, &extents);
+  cairo_move_to(cr, x + (PDF_STRIP_CELL_WIDTH - extents.width) / 2, y + PDF_STRIP_CELL_HEIGHT - 5);
+  cairo_show_text(cr, number);
+  g_free(number);
+}
+
+/* draws the pages in the viewport and asks for their thumbnails first */
+static gboolean draw_strip(GtkWidget* widget, cairo_t* cr, document_page_t* doc_page) {
+  TRACE_SCOPE("draw_strip");
+  double offset = gtk_adjustment_get_value(get_strip_adjustment(widget));
+  int firstRow = MAX(0, (int)(offset / PDF_STRIP_CELL_HEIGHT));
+  int lastRow = (int)((offset + gtk_widget_get_allocated_height(widget)) / PDF_STRIP_CELL_HEIGHT);
+  int first = firstRow * PDF_STRIP_COLUMNS;
+  int last = MIN(doc_page->page_count - 1, (lastRow + 1) * PDF_STRIP_COLUMNS - 1);
+  if (last < first || g_atomic_int_get(&doc_page->closed)) {
+    return FALSE;
+  }
+  request_thumbnails(doc_page, first, last);
+  cairo_translate(cr, 0, -offset);
+  for (int page = first; page <= last; page++) {
+    g_mutex_lock(&doc_page->cacheMutex);
+    cairo_surface_t* thumbnail = doc_page->thumbnails[page] ? cairo_surface_reference(doc_page->thumbnails[page]) : NULL;
+    g_mutex_unlock(&doc_page->cacheMutex);
+    draw_strip_cell(cr, doc_page, page, thumbnail);
+    if (thumbnail) {
+      cairo_surface_destroy(thumbnail);
+    }
+  }
+  return FALSE;
+}
+
+static gboolean click_strip(GtkWidget* widget, GdkEventButton* event, document_page_t* doc_page) {
+  if (g_atomic_int_get(&doc_page->closed)) {
+    return TRUE;
+  }
+  int column = (int)(event->x / PDF_STRIP_CELL_WIDTH);
+  int page = (int)((event->y + gtk_adjustment_get_value(get_strip_adjustment(widget))) / PDF_STRIP_CELL_HEIGHT) * PDF_STRIP_COLUMNS + column;
+  if (column < PDF_STRIP_COLUMNS && page >= 0 && page < doc_page->page_count && page != doc_page->page) {
+    doc_page->page = page;
+    render_doc_page(doc_page);
+    update_strip(doc_page);
+  }
+  return TRUE;
+}
+
+static gboolean scroll_strip(GtkWidget* widget, GdkEventScroll* event, document_page_t* doc_page) {
+  double delta = 0;
+  if (event->direction == GDK_SCROLL_UP) {
+    delta = -PDF_STRIP_CELL_HEIGHT;
+  } else if (event->direction == GDK_SCROLL_DOWN) {
+    delta = PDF_STRIP_CELL_HEIGHT;
+  } else if (event->direction == GDK_SCROLL_SMOOTH) {
+    delta = event->delta_y * PDF_STRIP_CELL_HEIGHT;
+  }
+  GtkAdjustment* adjustment = get_strip_adjustment(widget);
+  gtk_adjustment_set_value(adjustment, gtk_adjustment_get_value(adjustment) + delta);
+  return TRUE;
+}
+
+static void on_strip_scrolled(GtkAdjustment* adjustment, GtkWidget* strip) {
+  gtk_widget_queue_draw(strip);
+}
+
+/* the strip keeps its document alive, it may outlive it as the current one */
+static void on_strip_destroy(GtkWidget* widget, document_page_t* doc_page) {
+  // a new toolbar for the same document is built before the old one goes
+  if (doc_page->strip == widget) {
+    doc_page->strip = NULL;
+  }
+  unref_doc(doc_page);
+}
+
+/*
+ * An overview of all pages, thumbnails are rendered on a thread in viewport
+ * order and kept with the document. The area only has the size of the
+ * viewport and scrolls itself, long documents would exceed window size limits.
+ */
+static GtkWidget* create_page_strip(document_page_t* doc_page) {
+  int rows = (doc_page->page_count + PDF_STRIP_COLUMNS - 1) / PDF_STRIP_COLUMNS;
+  GtkAdjustment* adjustment = gtk_adjustment_new(0, 0, rows * PDF_STRIP_CELL_HEIGHT, PDF_STRIP_CELL_HEIGHT, PDF_STRIP_HEIGHT, PDF_STRIP_HEIGHT);
+  GtkWidget* strip = gtk_drawing_area_new();
+  g_object_set_data_full(G_OBJECT(strip), "adjustment", g_object_ref_sink(adjustment), g_object_unref);
+  gtk_widget_set_size_request(strip, PDF_STRIP_COLUMNS * PDF_STRIP_CELL_WIDTH, PDF_STRIP_HEIGHT);
+  gtk_widget_add_events(strip, GDK_BUTTON_PRESS_MASK | GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+  g_atomic_int_inc(&doc_page->refCount);
+  doc_page->strip = strip;
+  g_signal_connect(strip, "draw", G_CALLBACK(draw_strip), doc_page);
+  g_signal_connect(strip, "button-press-event", G_CALLBACK(click_strip), doc_page);
+  g_signal_connect(strip, "scroll-event", G_CALLBACK(scroll_strip), doc_page);
+  g_signal_connect(strip, "destroy", G_CALLBACK(on_strip_destroy), doc_page);
+  g_signal_connect_object(adjustment, "value-changed", G_CALLBACK(on_strip_scrolled), strip, 0);
+
+  GtkBox* hBox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_pack_start(hBox, strip, FALSE, FALSE, 0);
+  gtk_box_pack_start(hBox, gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, adjustment), FALSE, FALSE, 0);
+  return hBox;
+}
+
 static void click_prev_button( GtkWidget *widget, GdkEvent* ev, document_page_t* doc_page ) {
   if (doc_page->page > 0) {
     doc_page->page--;
   }
   render_doc_page(doc_page);
+  update_strip(doc_page);
 }
 
 static void click_next_button( GtkWidget *widget, GdkEvent* ev, document_page_t* doc_page ) {
@@ -115,10 +770,18 @@ static void click_next_button( GtkWidget *widget, GdkEvent* ev, document_page_t*
     doc_page->page++;
   }
   render_doc_page(doc_page);
+  update_strip(doc_page);
+}
+
+void render_current_pdf_page() {
+  if (currentDocument) {
+    render_doc_page(currentDocument);
+  }
 }
 
-GtkWidget* get_pdf_toolbar(void(*callback)(gpointer, int, int)) {
+GtkWidget* get_pdf_toolbar(void(*callback)(gpointer, int, int), void(*tiledCallback)(gpointer)) {
   currentDocument->on_render = callback;
+  currentDocument->on_render_tiled = tiledCallback;
   GtkBox* vBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
   
   GtkWidget* titleLabel = gtk_label_new(poppler_document_get_title(currentDocument->doc));
@@ -144,6 +807,7 @@ GtkWidget* get_pdf_toolbar(void(*callback)(gpointer, int, int)) {
   gtk_box_pack_start (hBox, button_next, FALSE, FALSE, 2);
   
   gtk_box_pack_start (vBox, hBox, FALSE, FALSE, 4);
+  gtk_box_pack_start (vBox, create_page_strip(currentDocument), FALSE, FALSE, 4);
   
   return vBox;
 }
\ No newline at end of file
@@ -1,6 +1,15 @@
 #include <gtk/gtk.h>
 #include <poppler.h>
 
+#include "tiles.h"
+#include "print-job.h"
+
+gboolean open_pdf_document(char* filename, int width, int height);
+void close_pdf_document();
 cairo_surface_t* get_pdf_cairo_surface(char* filename, int page, int width, int height);
+print_source_t* get_pdf_print_source(int firstPage, int lastPage);
 cairo_surface_t* get_pdf_thumbnail_cairo_surface(char* filename, int width, int height);
-GtkWidget* get_pdf_toolbar(void(*callback)(gpointer, int, int));
\ No newline at end of file
+tile_view_t* get_pdf_tile_view(int n_page);
+void set_pdf_prerender_pages(int pages);
+void render_current_pdf_page();
+GtkWidget* get_pdf_toolbar(void(*callback)(gpointer, int, int), void(*tiledCallback)(gpointer));
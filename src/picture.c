@@ -1,4 +1,19 @@
+#include <math.h>
+#include <string.h>
+
 #include "picture.h"
+#include "loader.h"
+#include "edit-stack.h"
+#include "trace.h"
+#include "memory-budget.h"
+#include "mipmap.h"
+
+#define PREVIEW_WIDTH 1920
+#define PREVIEW_HEIGHT 1080
+#define PICTURE_MAX_ZOOM 16.0 // relative to the fitted picture
+#define PICTURE_ZOOM_STEP 1.25 // per scroll step
+#define PICTURE_DOUBLE_TAP_ZOOM 3.0
+#define MIPMAP_MAX_SIZE 6144 // longest side of the zoom source, bounds memory for very large pictures
 
 typedef struct {
   cairo_surface_t* surface;
@@ -6,109 +21,702 @@ typedef struct {
   char* tempFilePath;
   int width;
   int height;
+  cairo_surface_t* displaySurface; // aspect-fitted copy for the current allocation
+  int displayAllocWidth;
+  int displayAllocHeight;
+  edit_stack_t* edits; // crop, rotate and effects, applied to surface without changing it
+  cairo_surface_t* processedSurface; // rendered edits, NULL without edits
+  gint64 surfaceBytes; // charged for surface when it was decoded here, shared surfaces are charged by their owner
+  mipmap_t* mipmap; // higher resolution for zooming, built in the background, NULL until then
+  gboolean mipmapEvicted; // dropped under memory pressure, built again on the next zoom
 } picture_t;
 
-static GtkImage* currentPicture = NULL; // original image
+typedef struct {
+  char* filename;
+  int generation;
+  double width; // size of the preview surface, the pyramid is drawn in its units
+  double height;
+  mipmap_t* mipmap;
+} mipmap_job_t;
 
 static picture_t* tempPicture = NULL; // unscaled processed image
 
-static GtkImage* uiPicture = NULL; // scaled version
+static tile_view_t* currentTiles = NULL; // large pages, drawn progressively instead of tempPicture
+
+static GtkWidget* pictureArea = NULL;
+
+static effect_params_t currentEffects; // state of the effects controls, mirrors the effects operation of the edit stack
+
+static guint effectsIdle = 0; // slider changes are coalesced into one pass per main loop iteration
+
+static GtkWidget* effectsToolbar = NULL;
+
+static double zoom = 1.0; // relative to the fitted picture, 1 shows all of it
+static double zoomCenterX = 0; // picture point at the center of the area, in picture units
+static double zoomCenterY = 0;
+static double gestureStartZoom = 1.0;
+static double dragStartX = 0;
+static double dragStartY = 0;
+static GtkGesture* zoomGesture = NULL; // gestures are not owned by their widget in GTK 3
+static GtkGesture* dragGesture = NULL;
+static GtkGesture* tapGesture = NULL;
+
+static GThreadPool* mipmapPool = NULL; // one thread, a newer picture makes queued jobs stale
+static gint pictureGeneration = 0; // incremented for every new picture
+
+static void free_current_tiles() {
+  if (currentTiles) {
+    tile_view_free(currentTiles);
+    currentTiles = NULL;
+  }
+}
+
+static cairo_surface_t* get_shown_surface(picture_t* pic) {
+  return pic->processedSurface ? pic->processedSurface : pic->surface;
+}
+
+/* size of what is shown in picture units and the scale that fits it into width x height */
+static gboolean get_view_size(int width, int height, double* pictureWidth, double* pictureHeight, double* fitScale) {
+  if (currentTiles) {
+    tile_view_get_size(currentTiles, pictureWidth, pictureHeight);
+    *fitScale = MIN(width / *pictureWidth, height / *pictureHeight);
+    return TRUE;
+  }
+  if (tempPicture) {
+    cairo_surface_t* shown = get_shown_surface(tempPicture);
+    *pictureWidth = cairo_image_surface_get_width(shown);
+    *pictureHeight = cairo_image_surface_get_height(shown);
+    // pictures are never enlarged to fit
+    *fitScale = MIN(1.0, MIN(width / *pictureWidth, height / *pictureHeight));
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * Scale and origin of the picture in the area at the current zoom. The zoom
+ * center is clamped on the way, so the picture never leaves empty space on a
+ * side it could cover, and is centered where it is smaller than the area.
+ */
+static void get_view_transform(int width, int height, double pictureWidth, double pictureHeight, double fitScale, double* scale, double* x, double* y) {
+  *scale = fitScale * zoom;
+  double halfWidth = width / 2.0 / *scale;
+  double halfHeight = height / 2.0 / *scale;
+  zoomCenterX = pictureWidth <= 2 * halfWidth ? pictureWidth / 2 : CLAMP(zoomCenterX, halfWidth, pictureWidth - halfWidth);
+  zoomCenterY = pictureHeight <= 2 * halfHeight ? pictureHeight / 2 : CLAMP(zoomCenterY, halfHeight, pictureHeight - halfHeight);
+  *x = width / 2.0 - zoomCenterX * *scale;
+  *y = height / 2.0 - zoomCenterY * *scale;
+}
+
+static void draw_tiles(GtkWidget *widget, cairo_t *cr, int width, int height) {
+  double sourceWidth, sourceHeight, fitScale, scale, x, y;
+  get_view_size(width, height, &sourceWidth, &sourceHeight, &fitScale);
+  get_view_transform(width, height, sourceWidth, sourceHeight, fitScale, &scale, &x, &y);
+  tile_view_draw(currentTiles, cr, scale, x, y, width, height);
+}
+
+/* zoomed in, from the pyramid when there is one for what is shown */
+static void draw_zoomed(cairo_t* cr, int width, int height) {
+  double pictureWidth, pictureHeight, fitScale, scale, x, y;
+  get_view_size(width, height, &pictureWidth, &pictureHeight, &fitScale);
+  get_view_transform(width, height, pictureWidth, pictureHeight, fitScale, &scale, &x, &y);
+  if (tempPicture->mipmap && edit_stack_is_empty(tempPicture->edits)) {
+    mipmap_draw(tempPicture->mipmap, cr, scale, x, y);
+    return;
+  }
+  // edited pictures and PDF pages only exist at preview resolution
+  cairo_translate(cr, x, y);
+  cairo_scale(cr, scale, scale);
+  cairo_set_source_surface(cr, get_shown_surface(tempPicture), 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+  cairo_paint(cr);
+}
+
+static void drop_display_surface(picture_t* pic) {
+  if (pic->displaySurface) {
+    memory_budget_release(MEMORY_POOL_PREVIEWS, memory_get_surface_bytes(pic->displaySurface));
+    cairo_surface_destroy(pic->displaySurface);
+    pic->displaySurface = NULL;
+  }
+}
+
+/* 
+ * Returns the picture scaled to fit into width x height, never enlarged.
+ * Only rebuilt when the allocation or the picture changes, so draws are a plain blit.
+ */
+static cairo_surface_t* get_display_surface(picture_t* pic, int width, int height) {
+  if (pic->displaySurface && pic->displayAllocWidth == width && pic->displayAllocHeight == height) {
+    return pic->displaySurface;
+  }
+  drop_display_surface(pic);
+  cairo_surface_t* shown = get_shown_surface(pic);
+  int shownWidth = cairo_image_surface_get_width(shown);
+  int shownHeight = cairo_image_surface_get_height(shown);
+  double scale = MIN(1.0, MIN((double)width / shownWidth, (double)height / shownHeight));
+  int displayWidth = MAX(1, (int)(shownWidth * scale + 0.5));
+  int displayHeight = MAX(1, (int)(shownHeight * scale + 0.5));
+
+  pic->displaySurface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, displayWidth, displayHeight);
+  memory_budget_charge(MEMORY_POOL_PREVIEWS, memory_get_surface_bytes(pic->displaySurface));
+  pic->displayAllocWidth = width;
+  pic->displayAllocHeight = height;
+
+  cairo_t* cr = cairo_create(pic->displaySurface);
+  cairo_scale(cr, (double)displayWidth / shownWidth, (double)displayHeight / shownHeight);
+  cairo_set_source_surface(cr, shown, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  return pic->displaySurface;
+}
 
 static gboolean
 draw_callback (GtkWidget *widget, cairo_t *cr, gpointer data)
 {
+  TRACE_SCOPE("draw_callback");
   guint width, height;
 
   width = gtk_widget_get_allocated_width (widget);
   height = gtk_widget_get_allocated_height (widget);
   
-  double wScale = 1.0;
-  double hScale = 1.0;
-  
-  int x = 0;
-  int y = 0;
+  cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
+  cairo_paint(cr);
   
-  if (tempPicture->width > width) {
-    wScale = tempPicture->width / width;
-  } else {
-    x = width / 2 - tempPicture->width / 2;
+  if (NULL != currentTiles) {
+    draw_tiles(widget, cr, width, height);
+    return TRUE;
   }
   
-  if (tempPicture->height > height) {
-    hScale = tempPicture->height / height;
-  } else {
-    y = height / 2 - tempPicture->height / 2;
+  if (NULL != tempPicture && zoom > 1.0) {
+    draw_zoomed(cr, width, height);
+    return TRUE;
   }
   
-  double scale = (wScale > hScale) ? hScale : wScale;
-  
-  cairo_set_source_rgb(cr, 0.1, 0.1, 0.1);
-  cairo_paint(cr);
-  
   if (NULL != tempPicture) {
-    cairo_set_source_surface(cr, tempPicture->surface, x, y);
-    cairo_rectangle(cr, x, y, width, height);
-    cairo_scale(cr, scale, scale);
-    cairo_fill(cr);
+    cairo_surface_t* display = get_display_surface(tempPicture, width, height);
+    int x = ((int)width - cairo_image_surface_get_width(display)) / 2;
+    int y = ((int)height - cairo_image_surface_get_height(display)) / 2;
+    cairo_set_source_surface(cr, display, x, y);
     cairo_paint(cr);
     return TRUE;
   }
 
-  cairo_fill (cr);
-
  return FALSE;
 }
 
+static void drop_mipmap(picture_t* pic) {
+  if (pic->mipmap) {
+    memory_budget_release(MEMORY_POOL_PREVIEWS, mipmap_get_bytes(pic->mipmap));
+    mipmap_free(pic->mipmap);
+    pic->mipmap = NULL;
+  }
+}
+
+/* the cached edit steps are rebuilt with the next edit, what is on screen stays */
+static void evict_previews(gint64 bytes, gpointer data) {
+  if (tempPicture) {
+    edit_stack_drop_cache(tempPicture->edits);
+    if (zoom <= 1.0 && tempPicture->mipmap) {
+      drop_mipmap(tempPicture);
+      tempPicture->mipmapEvicted = TRUE;
+    }
+  }
+}
+
+static void queue_mipmap(char* filename);
+
+/* zooms to newZoom, keeping the picture point under focusX, focusY in place */
+static void set_zoom(double newZoom, double focusX, double focusY) {
+  int width = gtk_widget_get_allocated_width(pictureArea);
+  int height = gtk_widget_get_allocated_height(pictureArea);
+  double pictureWidth, pictureHeight, fitScale, scale, x, y;
+  if (!get_view_size(width, height, &pictureWidth, &pictureHeight, &fitScale)) {
+    return;
+  }
+  get_view_transform(width, height, pictureWidth, pictureHeight, fitScale, &scale, &x, &y);
+  double pointX = (focusX - x) / scale;
+  double pointY = (focusY - y) / scale;
+  zoom = CLAMP(newZoom, 1.0, PICTURE_MAX_ZOOM);
+  double newScale = fitScale * zoom;
+  zoomCenterX = pointX + (width / 2.0 - focusX) / newScale;
+  zoomCenterY = pointY + (height / 2.0 - focusY) / newScale;
+  if (zoom > 1.0 && tempPicture && tempPicture->mipmapEvicted && tempPicture->originalFilePath) {
+    tempPicture->mipmapEvicted = FALSE;
+    queue_mipmap(tempPicture->originalFilePath);
+  }
+  gtk_widget_queue_draw(pictureArea);
+}
+
+static gboolean on_picture_scroll(GtkWidget* widget, GdkEventScroll* event, gpointer data) {
+  double factor = 1.0;
+  if (event->direction == GDK_SCROLL_UP) {
+    factor = PICTURE_ZOOM_STEP;
+  } else if (event->direction == GDK_SCROLL_DOWN) {
+    factor = 1.0 / PICTURE_ZOOM_STEP;
+  } else if (event->direction == GDK_SCROLL_SMOOTH) {
+    factor = pow(PICTURE_ZOOM_STEP, -event->delta_y);
+  }
+  set_zoom(zoom * factor, event->x, event->y);
+  return TRUE;
+}
+
+static void on_zoom_begin(GtkGesture* gesture, GdkEventSequence* sequence, gpointer data) {
+  gestureStartZoom = zoom;
+}
+
+static void on_zoom_scale_changed(GtkGestureZoom* gesture, double scale, gpointer data) {
+  double x, y;
+  if (gtk_gesture_get_bounding_box_center(GTK_GESTURE(gesture), &x, &y)) {
+    set_zoom(gestureStartZoom * scale, x, y);
+  }
+}
+
+static void on_drag_begin(GtkGestureDrag* gesture, double x, double y, gpointer data) {
+  dragStartX = zoomCenterX;
+  dragStartY = zoomCenterY;
+}
+
+static void on_drag_update(GtkGestureDrag* gesture, double offsetX, double offsetY, gpointer data) {
+  int width = gtk_widget_get_allocated_width(pictureArea);
+  int height = gtk_widget_get_allocated_height(pictureArea);
+  double pictureWidth, pictureHeight, fitScale;
+  if (zoom <= 1.0 || !get_view_size(width, height, &pictureWidth, &pictureHeight, &fitScale)) {
+    return;
+  }
+  zoomCenterX = dragStartX - offsetX / (fitScale * zoom);
+  zoomCenterY = dragStartY - offsetY / (fitScale * zoom);
+  gtk_widget_queue_draw(pictureArea);
+}
+
+/* a double tap zooms in on the tapped point, or back out */
+static void on_tap(GtkGestureMultiPress* gesture, int count, double x, double y, gpointer data) {
+  if (count == 2) {
+    set_zoom(zoom > 1.0 ? 1.0 : PICTURE_DOUBLE_TAP_ZOOM, x, y);
+  }
+}
+
 GtkDrawingArea* get_picture_area() {
   GtkDrawingArea* area = gtk_drawing_area_new();
+  pictureArea = area;
   
-  gtk_widget_set_size_request (area, 1920, 1080);
+  gtk_widget_set_size_request (area, PREVIEW_WIDTH, PREVIEW_HEIGHT);
+  gtk_widget_add_events (area, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK | GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK
+                         | GDK_BUTTON_MOTION_MASK | GDK_TOUCH_MASK);
   g_signal_connect (G_OBJECT (area), "draw",
                     G_CALLBACK (draw_callback), NULL);
+  g_signal_connect (G_OBJECT (area), "scroll-event",
+                    G_CALLBACK (on_picture_scroll), NULL);
+
+  zoomGesture = gtk_gesture_zoom_new(area);
+  g_signal_connect (zoomGesture, "begin", G_CALLBACK (on_zoom_begin), NULL);
+  g_signal_connect (zoomGesture, "scale-changed", G_CALLBACK (on_zoom_scale_changed), NULL);
+  dragGesture = gtk_gesture_drag_new(area);
+  g_signal_connect (dragGesture, "drag-begin", G_CALLBACK (on_drag_begin), NULL);
+  g_signal_connect (dragGesture, "drag-update", G_CALLBACK (on_drag_update), NULL);
+  tapGesture = gtk_gesture_multi_press_new(area);
+  g_signal_connect (tapGesture, "pressed", G_CALLBACK (on_tap), NULL);
+
+  memory_budget_set_evictor(MEMORY_POOL_PREVIEWS, evict_previews, NULL);
   
   return area;
 }
 
-static void draw_pixbuf(picture_t* pic, GdkPixbuf* pixBuf) {
-  cairo_t* cr = cairo_create(pic->surface);
-  gdk_cairo_set_source_pixbuf(cr, pixBuf, 0, 0);
-  cairo_rectangle(cr, 0, 0, pic->width, pic->height);
-  cairo_fill(cr);
-  cairo_destroy(cr);
+static void free_picture(picture_t* pic) {
+  drop_mipmap(pic);
+  memory_budget_release(MEMORY_POOL_PREVIEWS, pic->surfaceBytes);
+  cairo_surface_destroy(pic->surface);
+  drop_display_surface(pic);
+  if (pic->processedSurface) {
+    cairo_surface_destroy(pic->processedSurface);
+  }
+  edit_stack_free(pic->edits);
+  g_free(pic->originalFilePath);
+  g_free(pic);
+}
+
+/* hands a finished pyramid to the picture it was built for, on the main loop */
+static gboolean attach_mipmap(gpointer data) {
+  mipmap_job_t* job = (mipmap_job_t*)data;
+  if (job->mipmap && tempPicture && NULL == tempPicture->mipmap && job->generation == g_atomic_int_get(&pictureGeneration)) {
+    tempPicture->mipmap = job->mipmap;
+    memory_budget_charge(MEMORY_POOL_PREVIEWS, mipmap_get_bytes(job->mipmap));
+    if (zoom > 1.0) {
+      gtk_widget_queue_draw(pictureArea);
+    }
+  } else if (job->mipmap) {
+    mipmap_free(job->mipmap);
+  }
+  g_free(job->filename);
+  g_free(job);
+  return G_SOURCE_REMOVE;
+}
+
+static void build_mipmap(gpointer data, gpointer user_data) {
+  mipmap_job_t* job = (mipmap_job_t*)data;
+  // skipped when another picture was loaded meanwhile, or when the file has no more pixels than the preview
+  if (job->generation == g_atomic_int_get(&pictureGeneration)) {
+    TRACE_SCOPE("build_mipmap");
+    cairo_surface_t* base = load_surface_at_size(job->filename, MIPMAP_MAX_SIZE, MIPMAP_MAX_SIZE, NULL);
+    if (base && MAX(cairo_image_surface_get_width(base), cairo_image_surface_get_height(base)) > MAX(job->width, job->height)) {
+      job->mipmap = mipmap_new(base, job->width, job->height);
+    }
+    if (base) {
+      cairo_surface_destroy(base);
+    }
+  }
+  g_idle_add(attach_mipmap, job);
 }
 
-static void set_temp_picture(GdkPixbuf* pixbuf, int width, int height) {
+/* queues the zoom pyramid of the current picture, decoded again at up to MIPMAP_MAX_SIZE */
+static void queue_mipmap(char* filename) {
+  if (NULL == mipmapPool) {
+    mipmapPool = g_thread_pool_new(build_mipmap, NULL, 1, FALSE, NULL);
+  }
+  mipmap_job_t* job = (mipmap_job_t*)g_malloc0(sizeof(mipmap_job_t));
+  job->filename = g_strdup(filename);
+  job->generation = g_atomic_int_get(&pictureGeneration);
+  job->width = tempPicture->width;
+  job->height = tempPicture->height;
+  g_thread_pool_push(mipmapPool, job, NULL);
+}
+
+/* 
+ * Makes surface the current picture without copying it. The surface may be
+ * shared, e.g. with the PDF page cache, and must not be drawn into.
+ */
+static void set_temp_surface(cairo_surface_t* surface) {
+  TRACE_SCOPE("set_temp_surface");
+  free_current_tiles();
+  g_atomic_int_inc(&pictureGeneration);
+  zoom = 1.0;
   if (tempPicture) {
-    cairo_surface_destroy(tempPicture->surface);
-    g_object_ref_sink(currentPicture);
-    g_object_run_dispose(currentPicture);
-    g_free(tempPicture);
+    free_picture(tempPicture);
   }
-  tempPicture = (picture_t*)g_malloc(sizeof(picture_t));
-  tempPicture->width = gdk_pixbuf_get_width(pixbuf);
-  tempPicture->height = gdk_pixbuf_get_height(pixbuf);
-  tempPicture->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
-  draw_pixbuf(tempPicture, pixbuf);
-  currentPicture = gtk_image_new_from_pixbuf(pixbuf);
-  g_object_unref(pixbuf);
+  tempPicture = (picture_t*)g_malloc0(sizeof(picture_t));
+  tempPicture->width = cairo_image_surface_get_width(surface);
+  tempPicture->height = cairo_image_surface_get_height(surface);
+  tempPicture->surface = cairo_surface_reference(surface);
+  tempPicture->edits = edit_stack_new(surface);
+  effects_init_params(&currentEffects);
 }
 
 void load_current_picture(char* filename) {
-  GdkPixbuf * pixBuf = gdk_pixbuf_new_from_file (filename, NULL);
-  set_temp_picture(g_object_ref(pixBuf), gdk_pixbuf_get_width(pixBuf), gdk_pixbuf_get_height(pixBuf));
-  g_object_unref(pixBuf);
+  // the preview never shows more than the picture area, decode at that size
+  cairo_surface_t* surface = load_surface_at_size(filename, PREVIEW_WIDTH, PREVIEW_HEIGHT, NULL);
+  if (NULL == surface) {
+    surface = load_surface_at_size("assets/error.png", 0, 0, NULL);
+  }
+  set_temp_surface(surface);
+  tempPicture->originalFilePath = g_strdup(filename);
+  tempPicture->surfaceBytes = memory_get_surface_bytes(surface);
+  memory_budget_charge(MEMORY_POOL_PREVIEWS, tempPicture->surfaceBytes);
+  queue_mipmap(filename);
+  cairo_surface_destroy(surface);
 }
 
+/* adopts a reference to surface, e.g. a rendered PDF page */
 void set_current_picture(cairo_surface_t* surface, int width, int height) {
   if (NULL == surface) {
     load_current_picture("assets/error.png");
     return;
   }
-  GdkPixbuf* pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, width, height);
-  set_temp_picture(g_object_ref(pixbuf), width, height);
-  g_object_unref(pixbuf);
+  set_temp_surface(surface);
+}
+
+/*
+ * Decodes filename again for output at the given size, e.g. for printing, and
+ * runs edits on it. Without a file, e.g. for PDF pages, the edits run on the
+ * preview instead.
+ */
+static cairo_surface_t* render_output(char* filename, edit_stack_t* edits, cairo_surface_t* preview, int maxWidth, int maxHeight) {
+  TRACE_SCOPE("render output");
+  if (edit_stack_is_empty(edits)) {
+    cairo_surface_t* surface = filename ? load_surface_at_size(filename, maxWidth, maxHeight, NULL) : NULL;
+    return surface ? surface : cairo_surface_reference(preview);
+  }
+  // the preview only ever saw the proxy, the edits run again at full resolution for output
+  cairo_surface_t* source = NULL;
+  edit_op_t rotate;
+  if (filename) {
+    gboolean sideways = edit_stack_get_op(edits, EDIT_ROTATE, &rotate) && rotate.quarterTurns % 2;
+    source = sideways ? load_surface_at_size(filename, maxHeight, maxWidth, NULL)
+                      : load_surface_at_size(filename, maxWidth, maxHeight, NULL);
+  }
+  if (NULL == source) {
+    source = cairo_surface_reference(preview);
+  }
+  cairo_surface_t* processed = edit_stack_apply(edits, source);
+  cairo_surface_destroy(source);
+  return processed;
+}
+
+/* what a picture print job needs, the picture is decoded on the print thread when first asked for */
+typedef struct {
+  char* filename; // NULL for pictures that were not decoded from a file
+  edit_stack_t* edits; // a copy, editing goes on while the job runs
+  cairo_surface_t* preview;
+  int maxWidth;
+  int maxHeight;
+  cairo_surface_t* surface; // NULL until decoded
+} picture_print_t;
+
+static void free_picture_print(picture_print_t* print) {
+  if (print->surface) {
+    cairo_surface_destroy(print->surface);
+  }
+  edit_stack_free(print->edits);
+  cairo_surface_destroy(print->preview);
+  g_free(print->filename);
+  g_free(print);
+}
+
+static cairo_surface_t* get_print_surface(picture_print_t* print) {
+  if (NULL == print->surface) {
+    print->surface = render_output(print->filename, print->edits, print->preview, print->maxWidth, print->maxHeight);
+  }
+  return print->surface;
+}
+
+static int get_picture_print_page_count(picture_print_t* print) {
+  return 1;
+}
+
+static void get_picture_print_page_size(picture_print_t* print, int page, double* width, double* height) {
+  cairo_surface_t* surface = get_print_surface(print);
+  *width = cairo_image_surface_get_width(surface);
+  *height = cairo_image_surface_get_height(surface);
+}
+
+static void render_picture_print_page(picture_print_t* print, int page, cairo_t* cr) {
+  cairo_set_source_surface(cr, get_print_surface(print), 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+}
+
+/*
+ * The current picture with its edits for a print job, at no more than
+ * maxWidth x maxHeight. Decoding and the edits run on the print thread, once,
+ * so the UI stays responsive.
+ */
+print_source_t* get_picture_print_source(int maxWidth, int maxHeight) {
+  if (NULL == tempPicture) {
+    return NULL;
+  }
+  picture_print_t* print = g_new0(picture_print_t, 1);
+  print->filename = g_strdup(tempPicture->originalFilePath);
+  print->edits = edit_stack_copy(tempPicture->edits);
+  print->preview = cairo_surface_reference(tempPicture->surface);
+  print->maxWidth = maxWidth;
+  print->maxHeight = maxHeight;
+  print_source_t* source = print_source_new(print, (GDestroyNotify)free_picture_print);
+  source->get_page_count = (int(*)(gpointer))get_picture_print_page_count;
+  source->get_page_size = (void(*)(gpointer, int, double*, double*))get_picture_print_page_size;
+  source->render = (void(*)(gpointer, int, cairo_t*))render_picture_print_page;
+  return source;
+}
+
+/* renders the edit stack again, only operations after the first changed one are run */
+static void refresh_edits() {
+  if (tempPicture->processedSurface) {
+    cairo_surface_destroy(tempPicture->processedSurface);
+    tempPicture->processedSurface = NULL;
+  }
+  if (!edit_stack_is_empty(tempPicture->edits)) {
+    tempPicture->processedSurface = edit_stack_render(tempPicture->edits);
+  }
+  drop_display_surface(tempPicture);
+  gtk_widget_queue_draw(pictureArea);
+}
+
+static gboolean apply_current_effects(gpointer data) {
+  effectsIdle = 0;
+  if (NULL == tempPicture) {
+    return G_SOURCE_REMOVE;
+  }
+  edit_op_t op;
+  if (!edit_stack_get_op(tempPicture->edits, EDIT_EFFECTS, &op)) {
+    if (effects_are_identity(&currentEffects)) {
+      return G_SOURCE_REMOVE;
+    }
+    memset(&op, 0, sizeof(op));
+    op.kind = EDIT_EFFECTS;
+  }
+  op.effects = currentEffects;
+  edit_stack_set_op(tempPicture->edits, &op);
+  refresh_edits();
+  return G_SOURCE_REMOVE;
+}
+
+static void queue_effects() {
+  if (0 == effectsIdle) {
+    effectsIdle = g_idle_add(apply_current_effects, NULL);
+  }
+}
+
+/* replaces the effects of the current picture, the preview is updated on the next idle */
+void set_picture_effects(effect_params_t* params) {
+  currentEffects = *params;
+  queue_effects();
+}
+
+/* turns the current picture by quarterTurns clockwise, on top of earlier turns */
+void rotate_current_picture(int quarterTurns) {
+  if (NULL == tempPicture) {
+    return;
+  }
+  edit_op_t op;
+  if (!edit_stack_get_op(tempPicture->edits, EDIT_ROTATE, &op)) {
+    memset(&op, 0, sizeof(op));
+    op.kind = EDIT_ROTATE;
+  }
+  op.quarterTurns = (op.quarterTurns + quarterTurns + 4) % 4;
+  edit_stack_set_op(tempPicture->edits, &op);
+  zoom = 1.0; // the zoomed area moves elsewhere
+  refresh_edits();
+}
+
+/* crops the current picture to a rectangle given as fractions of its size before the crop */
+void crop_current_picture(double x, double y, double width, double height) {
+  if (NULL == tempPicture) {
+    return;
+  }
+  edit_op_t op;
+  memset(&op, 0, sizeof(op));
+  op.kind = EDIT_CROP;
+  op.cropX = x;
+  op.cropY = y;
+  op.cropWidth = width;
+  op.cropHeight = height;
+  edit_stack_set_op(tempPicture->edits, &op);
+  zoom = 1.0;
+  refresh_edits();
+}
+
+static void fill_effects_toolbar(GtkBox* vBox);
+
+static void sync_effects_controls() {
+  if (effectsIdle) {
+    // the controls are about to show the restored state, a pending change would overwrite it
+    g_source_remove(effectsIdle);
+    effectsIdle = 0;
+  }
+  edit_op_t op;
+  if (edit_stack_get_op(tempPicture->edits, EDIT_EFFECTS, &op)) {
+    currentEffects = op.effects;
+  } else {
+    effects_init_params(&currentEffects);
+  }
+  if (effectsToolbar) {
+    fill_effects_toolbar(GTK_BOX(effectsToolbar));
+    gtk_widget_show_all(effectsToolbar);
+  }
+}
+
+gboolean undo_current_picture() {
+  if (NULL == tempPicture || !edit_stack_undo(tempPicture->edits)) {
+    return FALSE;
+  }
+  sync_effects_controls();
+  refresh_edits();
+  return TRUE;
+}
+
+gboolean redo_current_picture() {
+  if (NULL == tempPicture || !edit_stack_redo(tempPicture->edits)) {
+    return FALSE;
+  }
+  sync_effects_controls();
+  refresh_edits();
+  return TRUE;
+}
+
+static void change_effect_value(GtkRange* range, double* value) {
+  *value = gtk_range_get_value(range);
+  queue_effects();
+}
+
+static void toggle_effect(GtkToggleButton* button, gboolean* value) {
+  *value = gtk_toggle_button_get_active(button);
+  queue_effects();
+}
+
+static void add_effect_slider(GtkBox* box, char* label, double min, double max, double* value) {
+  GtkWidget* scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, min, max, 0.05);
+  gtk_range_set_value(GTK_RANGE(scale), *value);
+  gtk_scale_add_mark(GTK_SCALE(scale), 0, GTK_POS_BOTTOM, NULL);
+  g_signal_connect(scale, "value-changed", G_CALLBACK(change_effect_value), value);
+  gtk_box_pack_start(box, gtk_label_new(label), FALSE, FALSE, 2);
+  gtk_box_pack_start(box, scale, FALSE, FALSE, 2);
+}
+
+static void add_effect_toggle(GtkBox* box, char* label, gboolean* value) {
+  GtkWidget* check = gtk_check_button_new_with_label(label);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(check), *value);
+  g_signal_connect(check, "toggled", G_CALLBACK(toggle_effect), value);
+  gtk_box_pack_start(box, check, FALSE, FALSE, 2);
+}
+
+static void click_rotate_left(GtkButton* button, gpointer data) {
+  rotate_current_picture(-1);
+}
+
+static void click_rotate_right(GtkButton* button, gpointer data) {
+  rotate_current_picture(1);
+}
+
+static void click_undo(GtkButton* button, gpointer data) {
+  undo_current_picture();
+}
+
+static void click_redo(GtkButton* button, gpointer data) {
+  redo_current_picture();
+}
+
+static void add_edit_button(GtkBox* box, char* label, GCallback callback) {
+  GtkWidget* button = gtk_button_new_with_label(label);
+  g_signal_connect(button, "clicked", callback, NULL);
+  gtk_box_pack_start(box, button, FALSE, FALSE, 2);
+}
+
+static void fill_effects_toolbar(GtkBox* vBox) {
+  GList* children = gtk_container_get_children(GTK_CONTAINER(vBox));
+  for (GList* iter = children; iter != NULL; iter = g_list_next(iter)) {
+    gtk_widget_destroy(GTK_WIDGET(iter->data));
+  }
+  g_list_free(children);
+
+  GtkBox* hBox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+  add_edit_button(hBox, "\u21BA", G_CALLBACK(click_rotate_left));
+  add_edit_button(hBox, "\u21BB", G_CALLBACK(click_rotate_right));
+  add_edit_button(hBox, "Undo", G_CALLBACK(click_undo));
+  add_edit_button(hBox, "Redo", G_CALLBACK(click_redo));
+  gtk_box_pack_start(vBox, hBox, FALSE, FALSE, 4);
+
+  add_effect_slider(vBox, "Brightness", -1, 1, &currentEffects.brightness);
+  add_effect_slider(vBox, "Contrast", -1, 1, &currentEffects.contrast);
+  add_effect_slider(vBox, "Sharpen", 0, 2, &currentEffects.sharpen);
+  add_effect_toggle(vBox, "Auto levels", &currentEffects.autoLevels);
+  add_effect_toggle(vBox, "Grayscale", &currentEffects.grayscale);
+  add_effect_toggle(vBox, "Sepia", &currentEffects.sepia);
 }
 
-GtkImage* get_current_picture() {
-  return currentPicture;
-}
\ No newline at end of file
+/* edit controls for the current picture: rotation, undo/redo and effects */
+GtkWidget* get_effects_toolbar() {
+  GtkBox* vBox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+  fill_effects_toolbar(vBox);
+  effectsToolbar = vBox;
+  g_signal_connect(vBox, "destroy", G_CALLBACK(gtk_widget_destroyed), &effectsToolbar);
+  return vBox;
+}
+
+/* shows a tiled source, e.g. a large PDF page, takes ownership of the view */
+void set_current_tiled_picture(tile_view_t* view) {
+  if (NULL == view) {
+    load_current_picture("assets/error.png");
+    return;
+  }
+  free_current_tiles();
+  currentTiles = view;
+  zoom = 1.0;
+  tile_view_set_refined_callback(view, (void(*)(gpointer))gtk_widget_queue_draw, pictureArea);
+}
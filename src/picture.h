@@ -1,7 +1,18 @@
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#include "tiles.h"
+#include "effects.h"
+#include "print-job.h"
+
 GtkDrawingArea* get_picture_area();
-GtkImage* get_current_picture();
 void load_current_picture(char* filename);
-void set_current_picture(cairo_surface_t* surface, int width, int height);
\ No newline at end of file
+void set_current_picture(cairo_surface_t* surface, int width, int height);
+print_source_t* get_picture_print_source(int maxWidth, int maxHeight);
+void set_current_tiled_picture(tile_view_t* view);
+void set_picture_effects(effect_params_t* params);
+void rotate_current_picture(int quarterTurns);
+void crop_current_picture(double x, double y, double width, double height);
+gboolean undo_current_picture();
+gboolean redo_current_picture();
+GtkWidget* get_effects_toolbar();
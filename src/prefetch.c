@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "prefetch.h"
+#include "file-type.h"
+#include "thumbnail.h"
+#include "thumbnail-cache.h"
+
+#define PREFETCH_MAX_DEPTH 8
+#define PREFETCH_MAX_FILES 5000
+#define PREFETCH_READAHEAD_BYTES (256 * 1024)
+#define PREFETCH_IDLE_MS 500 // quiet time after interactive loads
+#define PREFETCH_FILE_DELAY_USEC (5 * 1000)
+
+typedef struct {
+  char* path;
+  int depth;
+} prefetch_dir_t;
+
+typedef struct {
+  char* root;
+  gint generation;
+} prefetch_run_t;
+
+static gint currentGeneration = 0; // a run stops once this moves on
+static gint lastInteractiveMs = 0; // monotonic milliseconds, wraps; set on the main thread, read by the prefetcher
+
+static guint get_monotonic_ms() {
+  return (guint)(g_get_monotonic_time() / 1000);
+}
+
+/* called by interactive loads, the prefetcher backs off for a while */
+void prefetch_notify_interactive() {
+  g_atomic_int_set(&lastInteractiveMs, (gint)get_monotonic_ms());
+}
+
+/* waits until nothing interactive is going on, FALSE when the run was stopped */
+static gboolean wait_for_idle(prefetch_run_t* run) {
+  for (;;) {
+    if (g_atomic_int_get(&currentGeneration) != run->generation) {
+      return FALSE;
+    }
+    // unsigned difference, correct across the wrap
+    if (!thumbnail_is_busy() && get_monotonic_ms() - (guint)g_atomic_int_get(&lastInteractiveMs) > PREFETCH_IDLE_MS) {
+      return TRUE;
+    }
+    g_usleep(50 * 1000);
+  }
+}
+
+/* asks the kernel to read the start of the file, where headers and EXIF live */
+static void read_ahead(char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, PREFETCH_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+static void prefetch_file(char* path, file_type_t type) {
+  read_ahead(path);
+  GdkPixbuf* thumbnail = thumbnail_cache_lookup(path);
+  if (NULL == thumbnail) {
+    thumbnail = create_thumbnail_pixbuf(path, type == FILE_TYPE_PDF ? THUMBNAIL_PDF : THUMBNAIL_IMAGE);
+    thumbnail_cache_store(path, thumbnail);
+  }
+  if (thumbnail) {
+    g_object_unref(thumbnail);
+  }
+}
+
+/* walks the device breadth-first, so the folders customers open first are warm first */
+static gpointer prefetch_worker(gpointer data) {
+  prefetch_run_t* run = (prefetch_run_t*)data;
+  GQueue dirs = G_QUEUE_INIT;
+  int files = 0;
+  prefetch_dir_t* root = g_new0(prefetch_dir_t, 1);
+  root->path = g_strdup(run->root);
+  g_queue_push_tail(&dirs, root);
+
+  while (!g_queue_is_empty(&dirs) && files < PREFETCH_MAX_FILES) {
+    prefetch_dir_t* dirInfo = g_queue_pop_head(&dirs);
+    GDir* dir = wait_for_idle(run) ? g_dir_open(dirInfo->path, 0, NULL) : NULL;
+    const gchar* filename;
+    while (dir && (filename = g_dir_read_name(dir)) && files < PREFETCH_MAX_FILES) {
+      char* path = g_build_filename(dirInfo->path, filename, NULL);
+      if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        if (dirInfo->depth < PREFETCH_MAX_DEPTH && filename[0] != '.') {
+          prefetch_dir_t* child = g_new0(prefetch_dir_t, 1);
+          child->path = path;
+          child->depth = dirInfo->depth + 1;
+          g_queue_push_tail(&dirs, child);
+          continue;
+        }
+      } else {
+        file_type_t type = get_file_type(path, filename);
+        if (type != FILE_TYPE_OTHER) {
+          if (!wait_for_idle(run)) {
+            g_free(path);
+            break;
+          }
+          prefetch_file(path, type);
+          files++;
+          g_usleep(PREFETCH_FILE_DELAY_USEC);
+        }
+      }
+      g_free(path);
+    }
+    if (dir) {
+      g_dir_close(dir);
+    }
+    g_free(dirInfo->path);
+    g_free(dirInfo);
+  }
+  while (!g_queue_is_empty(&dirs)) {
+    prefetch_dir_t* dirInfo = g_queue_pop_head(&dirs);
+    g_free(dirInfo->path);
+    g_free(dirInfo);
+  }
+  g_print("Prefetched %i files\n", files);
+  g_free(run->root);
+  g_free(run);
+  return NULL;
+}
+
+/* starts warming the thumbnail cache for a newly mounted device */
+void prefetch_start(char* root) {
+  prefetch_run_t* run = g_new0(prefetch_run_t, 1);
+  run->root = g_strdup(root);
+  run->generation = g_atomic_int_add(&currentGeneration, 1) + 1;
+  g_thread_unref(g_thread_new("prefetch", prefetch_worker, run));
+}
+
+/* the running walk stops at the next file and frees itself */
+void prefetch_stop() {
+  g_atomic_int_inc(&currentGeneration);
+}
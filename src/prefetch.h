@@ -0,0 +1,5 @@
+#include <glib.h>
+
+void prefetch_start(char* root);
+void prefetch_stop();
+void prefetch_notify_interactive();
@@ -0,0 +1,465 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "color.h"
+#include "memory-budget.h"
+#include "print-job.h"
+#include "trace.h"
+
+#define PRINT_BAND_ROWS 256 // rows rendered at once, a band is the only page sized buffer
+#define PWG_HEADER_SIZE 1796
+#define PWG_COLOR_SPACE_RGB 1 // device RGB, after conversion to the printer profile
+#define PWG_COLOR_SPACE_SRGB 19
+#define PWG_MAX_RUN 128
+#define PRINT_MAX_BUFFERED_BYTES (64 * 1024 * 1024) // finished pages waiting for the writer, photos barely compress
+
+struct print_job {
+  print_source_t* source;
+  char* outputPath;
+  double dpi;
+  double paperWidth; // points
+  double paperHeight;
+  color_transform_t* colorTransform; // sRGB to the printer profile, NULL without one
+  GCancellable* cancellable;
+  print_progress_callback_t on_progress;
+  print_done_callback_t on_done;
+  gpointer data;
+  GMutex mutex; // guards the page hand-over between workers and the writer
+  GCond cond;
+  int pageCount;
+  int nextPage; // next page a worker takes
+  int nextWrite; // next page the writer appends, finished pages wait in pages until then
+  int window; // pages may be rendered at most this far ahead of nextWrite
+  gint64 bufferedBytes; // finished pages not yet written, charged to the memory budget
+  GByteArray** pages;
+  gboolean stopped;
+};
+
+typedef struct {
+  print_job_t* job;
+  gpointer data; // the source data, or a copy made for this worker
+} print_worker_t;
+
+typedef struct {
+  print_job_t* job;
+  int page;
+  int pageCount;
+  double pagesPerSecond;
+  GError* error;
+} print_notify_t;
+
+/* PWG raster (PWG 5102.4) stream, the format CUPS spools for raster printers */
+typedef struct {
+  GByteArray* output; // the encoded page
+  int width;
+  guint8* line; // last line, written once its repeat count is known
+  guint8* next;
+  int repeat;
+  guint8* encoded;
+} pwg_writer_t;
+
+static void put_be32(guint8* buffer, int offset, guint32 value) {
+  buffer[offset] = value >> 24;
+  buffer[offset + 1] = value >> 16;
+  buffer[offset + 2] = value >> 8;
+  buffer[offset + 3] = value;
+}
+
+static void pwg_write(pwg_writer_t* writer, const void* data, size_t size) {
+  g_byte_array_append(writer->output, data, size);
+}
+
+static void pwg_write_page_header(pwg_writer_t* writer, int width, int height, double dpi, double paperWidth, double paperHeight, int pageCount, int colorSpace) {
+  guint8 header[PWG_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  strcpy((char*)header, "PwgRaster"); // MediaClass
+  put_be32(header, 276, (guint32)dpi); // HWResolution
+  put_be32(header, 280, (guint32)dpi);
+  put_be32(header, 340, 1); // NumCopies
+  put_be32(header, 352, (guint32)(paperWidth + 0.5)); // PageSize in points
+  put_be32(header, 356, (guint32)(paperHeight + 0.5));
+  put_be32(header, 372, width); // cupsWidth
+  put_be32(header, 376, height); // cupsHeight
+  put_be32(header, 384, 8); // cupsBitsPerColor
+  put_be32(header, 388, 24); // cupsBitsPerPixel
+  put_be32(header, 392, width * 3); // cupsBytesPerLine
+  put_be32(header, 400, colorSpace); // cupsColorSpace
+  put_be32(header, 420, 3); // cupsNumColors
+  put_be32(header, 452, pageCount); // TotalPageCount
+  put_be32(header, 456, 1); // CrossFeedTransform
+  put_be32(header, 460, 1); // FeedTransform
+  put_be32(header, 480, 0xffffff); // AlternatePrimary
+  if (fabs(paperWidth - PRINT_A4_WIDTH) < 1 && fabs(paperHeight - PRINT_A4_HEIGHT) < 1) {
+    strcpy((char*)header + 1732, "iso_a4_210x297mm"); // cupsPageSizeName
+  }
+  pwg_write(writer, header, sizeof(header));
+}
+
+/* one line repeat byte, then runs of equal pixels (count - 1) or literal pixels (257 - count) */
+static void pwg_flush_line(pwg_writer_t* writer) {
+  if (writer->repeat == 0) {
+    return;
+  }
+  guint8* line = writer->line;
+  guint8* out = writer->encoded;
+  int width = writer->width;
+  int n = 0;
+  out[n++] = writer->repeat - 1;
+  int x = 0;
+  while (x < width) {
+    guint8* pixel = line + x * 3;
+    int count = 1;
+    if (x + 1 < width && memcmp(pixel, pixel + 3, 3) == 0) {
+      while (x + count < width && count < PWG_MAX_RUN && memcmp(pixel, line + (x + count) * 3, 3) == 0) {
+        count++;
+      }
+      out[n++] = count - 1;
+      memcpy(out + n, pixel, 3);
+      n += 3;
+    } else {
+      // literal pixels up to the start of the next run
+      while (x + count < width && count < PWG_MAX_RUN
+             && !(x + count + 1 < width && memcmp(line + (x + count) * 3, line + (x + count + 1) * 3, 3) == 0)) {
+        count++;
+      }
+      out[n++] = count == 1 ? 0 : 257 - count;
+      memcpy(out + n, pixel, count * 3);
+      n += count * 3;
+    }
+    x += count;
+  }
+  pwg_write(writer, out, n);
+  writer->repeat = 0;
+}
+
+/* takes writer->next as the following line, identical lines only bump the repeat count */
+static void pwg_push_line(pwg_writer_t* writer) {
+  if (writer->repeat > 0 && writer->repeat < 256 && memcmp(writer->line, writer->next, writer->width * 3) == 0) {
+    writer->repeat++;
+    return;
+  }
+  pwg_flush_line(writer);
+  guint8* line = writer->line;
+  writer->line = writer->next;
+  writer->next = line;
+  writer->repeat = 1;
+}
+
+static void pwg_begin_page(pwg_writer_t* writer, int width) {
+  if (writer->width != width) {
+    g_free(writer->line);
+    g_free(writer->next);
+    g_free(writer->encoded);
+    writer->width = width;
+    writer->line = g_malloc(width * 3);
+    writer->next = g_malloc(width * 3);
+    writer->encoded = g_malloc(width * 4 + 1);
+  }
+  writer->repeat = 0;
+}
+
+static void free_pwg_writer(pwg_writer_t* writer) {
+  g_free(writer->line);
+  g_free(writer->next);
+  g_free(writer->encoded);
+}
+
+static void free_job(print_job_t* job) {
+  if (job->source->destroy) {
+    job->source->destroy(job->source->data);
+  }
+  g_free(job->source);
+  g_free(job->outputPath);
+  g_object_unref(job->cancellable);
+  g_mutex_clear(&job->mutex);
+  g_cond_clear(&job->cond);
+  g_free(job->pages);
+  g_free(job);
+}
+
+static gboolean notify_progress(gpointer data) {
+  print_notify_t* notify = (print_notify_t*)data;
+  if (notify->job->on_progress && !g_cancellable_is_cancelled(notify->job->cancellable)) {
+    notify->job->on_progress(notify->page, notify->pageCount, notify->pagesPerSecond, notify->job->data);
+  }
+  g_free(notify);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean notify_done(gpointer data) {
+  print_notify_t* notify = (print_notify_t*)data;
+  if (notify->job->on_done) {
+    notify->job->on_done(notify->error, notify->job->data);
+  }
+  if (notify->error) {
+    g_error_free(notify->error);
+  }
+  free_job(notify->job);
+  g_free(notify);
+  return G_SOURCE_REMOVE;
+}
+
+/* renders a page band by band, source pages are fitted and centered on the paper */
+static gboolean print_page(print_job_t* job, gpointer data, pwg_writer_t* writer, cairo_surface_t* band, int page) {
+  TRACE_SCOPE("print_page");
+  double scale = job->dpi / 72.0;
+  int width = cairo_image_surface_get_width(band);
+  int height = MAX(1, (int)ceil(job->paperHeight * scale));
+  double sourceWidth, sourceHeight;
+  job->source->get_page_size(data, page, &sourceWidth, &sourceHeight);
+  double fit = MIN(job->paperWidth / sourceWidth, job->paperHeight / sourceHeight);
+  double offsetX = (job->paperWidth - sourceWidth * fit) / 2;
+  double offsetY = (job->paperHeight - sourceHeight * fit) / 2;
+
+  pwg_write_page_header(writer, width, height, job->dpi, job->paperWidth, job->paperHeight, job->pageCount,
+                        job->colorTransform ? PWG_COLOR_SPACE_RGB : PWG_COLOR_SPACE_SRGB);
+  pwg_begin_page(writer, width);
+  for (int y = 0; y < height; y += PRINT_BAND_ROWS) {
+    if (g_cancellable_is_cancelled(job->cancellable) || g_atomic_int_get(&job->stopped)) {
+      return FALSE;
+    }
+    int rows = MIN(PRINT_BAND_ROWS, height - y);
+    cairo_t* cr = cairo_create(band);
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+    cairo_rectangle(cr, 0, 0, width, rows);
+    cairo_clip(cr);
+    cairo_translate(cr, 0, -y);
+    cairo_scale(cr, scale, scale);
+    cairo_translate(cr, offsetX, offsetY);
+    cairo_scale(cr, fit, fit);
+    job->source->render(data, page, cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(band);
+
+    guint8* pixels = cairo_image_surface_get_data(band);
+    int stride = cairo_image_surface_get_stride(band);
+    if (job->colorTransform) {
+      // on this thread, the workers already keep every core busy with a page each
+      color_transform_rows(job->colorTransform, pixels, stride, width, rows);
+    }
+    for (int row = 0; row < rows; row++) {
+      guint32* line = (guint32*)(pixels + row * stride);
+      guint8* rgb = writer->next;
+      for (int x = 0; x < width; x++) {
+        rgb[x * 3] = line[x] >> 16;
+        rgb[x * 3 + 1] = line[x] >> 8;
+        rgb[x * 3 + 2] = line[x];
+      }
+      pwg_push_line(writer);
+    }
+  }
+  pwg_flush_line(writer);
+  return TRUE;
+}
+
+/*
+ * Takes pages in order and encodes them into memory, at most job->window pages
+ * ahead of the writer. Past PRINT_MAX_BUFFERED_BYTES of finished pages, only
+ * the page the writer waits for may still be started.
+ */
+static gpointer run_print_worker(gpointer data) {
+  print_worker_t* worker = (print_worker_t*)data;
+  print_job_t* job = worker->job;
+  int width = MAX(1, (int)ceil(job->paperWidth * job->dpi / 72.0));
+  cairo_surface_t* band = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, PRINT_BAND_ROWS);
+  pwg_writer_t writer;
+  memset(&writer, 0, sizeof(writer));
+
+  for (;;) {
+    g_mutex_lock(&job->mutex);
+    while (!job->stopped && job->nextPage < job->pageCount
+           && (job->nextPage >= job->nextWrite + job->window
+               || (job->bufferedBytes > PRINT_MAX_BUFFERED_BYTES && job->nextPage > job->nextWrite))) {
+      g_cond_wait(&job->cond, &job->mutex);
+    }
+    int page = job->stopped ? job->pageCount : job->nextPage++;
+    g_mutex_unlock(&job->mutex);
+    if (page >= job->pageCount) {
+      break;
+    }
+    writer.output = g_byte_array_new();
+    if (!print_page(job, worker->data, &writer, band, page)) {
+      g_byte_array_unref(writer.output);
+      break;
+    }
+    g_mutex_lock(&job->mutex);
+    job->pages[page] = writer.output;
+    job->bufferedBytes += writer.output->len;
+    memory_budget_charge(MEMORY_POOL_PRINT_PAGES, writer.output->len);
+    g_cond_broadcast(&job->cond);
+    g_mutex_unlock(&job->mutex);
+  }
+  cairo_surface_destroy(band);
+  free_pwg_writer(&writer);
+  return NULL;
+}
+
+static void stop_workers(print_job_t* job) {
+  g_mutex_lock(&job->mutex);
+  job->stopped = TRUE;
+  g_cond_broadcast(&job->cond);
+  g_mutex_unlock(&job->mutex);
+}
+
+static void notify_job_progress(print_job_t* job, int pages, gint64 startTime) {
+  print_notify_t* progress = g_new0(print_notify_t, 1);
+  progress->job = job;
+  progress->page = pages;
+  progress->pageCount = job->pageCount;
+  progress->pagesPerSecond = pages / MAX(0.001, (g_get_monotonic_time() - startTime) / (double)G_USEC_PER_SEC);
+  g_idle_add(notify_progress, progress);
+}
+
+/*
+ * Renders pages on one worker per core, each with its own copy of the source,
+ * and appends them to the spool file in page order as they become ready.
+ */
+static gpointer run_print_job(gpointer data) {
+  print_job_t* job = (print_job_t*)data;
+  print_notify_t* done = g_new0(print_notify_t, 1);
+  done->job = job;
+  gint64 startTime = g_get_monotonic_time();
+
+  gchar* tempPath = g_strconcat(job->outputPath, ".tmp", NULL);
+  FILE* file = g_fopen(tempPath, "wb");
+  if (NULL == file) {
+    int errsv = errno;
+    g_set_error(&done->error, G_IO_ERROR, g_io_error_from_errno(errsv), "%s: %s", tempPath, g_strerror(errsv));
+    g_free(tempPath);
+    g_idle_add(notify_done, done);
+    return NULL;
+  }
+  gboolean failed = fwrite("RaS2", 1, 4, file) != 4;
+
+  job->pageCount = job->source->get_page_count(job->source->data);
+  job->pages = g_new0(GByteArray*, MAX(1, job->pageCount));
+  int workerCount = job->source->copy ? CLAMP((int)g_get_num_processors(), 1, MAX(1, job->pageCount)) : 1;
+  job->window = workerCount;
+  print_worker_t* workers = g_new0(print_worker_t, workerCount);
+  GThread** threads = g_new0(GThread*, workerCount);
+  for (int i = 0; i < workerCount; i++) {
+    workers[i].job = job;
+    workers[i].data = job->source->copy ? job->source->copy(job->source->data) : job->source->data;
+    threads[i] = g_thread_new("print", run_print_worker, &workers[i]);
+  }
+
+  // reorder buffer: pages finish in any order, the file gets them in sequence
+  for (int page = 0; page < job->pageCount && !failed; page++) {
+    g_mutex_lock(&job->mutex);
+    while (NULL == job->pages[page] && !g_cancellable_is_cancelled(job->cancellable)) {
+      g_cond_wait(&job->cond, &job->mutex);
+    }
+    GByteArray* bytes = job->pages[page];
+    job->pages[page] = NULL;
+    if (bytes) {
+      job->bufferedBytes -= bytes->len;
+      memory_budget_release(MEMORY_POOL_PRINT_PAGES, bytes->len);
+    }
+    g_mutex_unlock(&job->mutex);
+    if (NULL == bytes) {
+      break;
+    }
+    failed = fwrite(bytes->data, 1, bytes->len, file) != bytes->len;
+    g_byte_array_unref(bytes);
+
+    g_mutex_lock(&job->mutex);
+    job->nextWrite = page + 1;
+    g_cond_broadcast(&job->cond);
+    g_mutex_unlock(&job->mutex);
+    notify_job_progress(job, page + 1, startTime);
+  }
+
+  stop_workers(job);
+  for (int i = 0; i < workerCount; i++) {
+    g_thread_join(threads[i]);
+    if (job->source->copy && job->source->destroy) {
+      job->source->destroy(workers[i].data);
+    }
+  }
+  for (int page = 0; page < job->pageCount; page++) {
+    if (job->pages[page]) {
+      memory_budget_release(MEMORY_POOL_PRINT_PAGES, job->pages[page]->len);
+      g_byte_array_unref(job->pages[page]);
+      job->pages[page] = NULL;
+    }
+  }
+  g_free(threads);
+  g_free(workers);
+
+  if (fclose(file) != 0) {
+    failed = TRUE;
+  }
+  if (g_cancellable_set_error_if_cancelled(job->cancellable, &done->error)) {
+    g_unlink(tempPath);
+  } else if (failed || g_rename(tempPath, job->outputPath) != 0) {
+    int errsv = errno;
+    g_set_error(&done->error, G_IO_ERROR, g_io_error_from_errno(errsv), "%s: %s", job->outputPath, g_strerror(errsv));
+    g_unlink(tempPath);
+  } else {
+    double seconds = (g_get_monotonic_time() - startTime) / (double)G_USEC_PER_SEC;
+    g_print("Printed %i pages in %.1fs (%.1f pages/s, %i workers)\n", job->pageCount, seconds, job->pageCount / MAX(0.001, seconds), workerCount);
+  }
+  g_free(tempPath);
+  g_idle_add(notify_done, done);
+  return NULL;
+}
+
+print_source_t* print_source_new(gpointer data, GDestroyNotify destroy) {
+  print_source_t* source = g_new0(print_source_t, 1);
+  source->data = data;
+  source->destroy = destroy;
+  return source;
+}
+
+/*
+ * Prints source as PWG raster to outputPath on a background thread, taking
+ * ownership of source. Pages are rendered in bands of PRINT_BAND_ROWS and kept
+ * only in encoded form. Workers stay at most one page each ahead of the writer
+ * and stop taking pages while PRINT_MAX_BUFFERED_BYTES of them wait, so memory
+ * is bounded by that plus one page per worker, whatever the page count.
+ * Callbacks run on the main loop.
+ */
+print_job_t* print_job_start(print_source_t* source, char* outputPath, double dpi, double paperWidth, double paperHeight,
+                             print_progress_callback_t progress, print_done_callback_t done, gpointer data) {
+  print_job_t* job = g_new0(print_job_t, 1);
+  job->source = source;
+  job->outputPath = g_strdup(outputPath);
+  job->dpi = dpi > 0 ? dpi : PRINT_DEFAULT_DPI;
+  job->paperWidth = paperWidth;
+  job->paperHeight = paperHeight;
+  job->colorTransform = color_get_transform(NULL, color_get_printer_profile(), COLOR_INTENT_PERCEPTUAL, CAIRO_FORMAT_RGB24);
+  job->cancellable = g_cancellable_new();
+  job->on_progress = progress;
+  job->on_done = done;
+  job->data = data;
+  g_mutex_init(&job->mutex);
+  g_cond_init(&job->cond);
+  g_thread_unref(g_thread_new("print", run_print_job, job));
+  return job;
+}
+
+/* stops after the current band, the done callback still runs */
+void print_job_cancel(print_job_t* job) {
+  g_cancellable_cancel(job->cancellable);
+  g_mutex_lock(&job->mutex);
+  g_cond_broadcast(&job->cond);
+  g_mutex_unlock(&job->mutex);
+}
+
+/* a new file name in the spool directory */
+char* get_print_spool_path() {
+  char* directory = g_build_filename(g_get_user_cache_dir(), "picture-box", "spool", NULL);
+  g_mkdir_with_parents(directory, 0700);
+  GDateTime* now = g_date_time_new_now_local();
+  gchar* name = g_date_time_format(now, "job-%Y%m%d-%H%M%S");
+  gchar* filename = g_strdup_printf("%s-%06i.pwg", name, g_date_time_get_microsecond(now));
+  char* path = g_build_filename(directory, filename, NULL);
+  g_free(filename);
+  g_free(name);
+  g_date_time_unref(now);
+  g_free(directory);
+  return path;
+}
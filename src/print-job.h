@@ -0,0 +1,38 @@
+#ifndef PRINT_JOB_H
+#define PRINT_JOB_H
+
+#include <gtk/gtk.h>
+
+#define PRINT_DEFAULT_DPI 300.0
+#define PRINT_A4_WIDTH 595.0 // points
+#define PRINT_A4_HEIGHT 842.0
+
+/*
+ * Pages to print. Callbacks run on print threads, render draws a whole page
+ * into cr, which is already scaled to the units of get_page_size. With copy,
+ * every worker thread renders from its own copy of data, otherwise pages are
+ * rendered one after the other.
+ */
+typedef struct {
+  int(*get_page_count)(gpointer data);
+  void(*get_page_size)(gpointer data, int page, double* width, double* height);
+  void(*render)(gpointer data, int page, cairo_t* cr);
+  gpointer(*copy)(gpointer data);
+  GDestroyNotify destroy;
+  gpointer data;
+} print_source_t;
+
+typedef struct print_job print_job_t;
+
+/* page is the number of pages written so far */
+typedef void(*print_progress_callback_t)(int page, int pageCount, double pagesPerSecond, gpointer data);
+/* error is NULL on success and G_IO_ERROR_CANCELLED after print_job_cancel, the job is freed afterwards */
+typedef void(*print_done_callback_t)(GError* error, gpointer data);
+
+print_source_t* print_source_new(gpointer data, GDestroyNotify destroy);
+print_job_t* print_job_start(print_source_t* source, char* outputPath, double dpi, double paperWidth, double paperHeight,
+                             print_progress_callback_t progress, print_done_callback_t done, gpointer data);
+void print_job_cancel(print_job_t* job);
+char* get_print_spool_path();
+
+#endif
@@ -0,0 +1,253 @@
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include "thumbnail-cache.h"
+#include "trace.h"
+#include "memory-budget.h"
+
+#define THUMBNAIL_CACHE_DEFAULT_DISK_BYTES (256 * 1024 * 1024)
+#define THUMBNAIL_CACHE_DEFAULT_MEMORY_ITEMS 512
+
+typedef struct {
+  char* key;
+  GdkPixbuf* pixbuf;
+} memory_entry_t;
+
+typedef struct {
+  char* key;
+  gint64 size;
+  gint64 lastUsed;
+} disk_entry_t;
+
+static GMutex cacheMutex;
+static char* cacheDirectory = NULL;
+
+static GHashTable* memoryEntries = NULL; // key -> GList link in memoryOrder
+static GQueue memoryOrder = G_QUEUE_INIT; // most recently used first
+static guint memoryCapacity = THUMBNAIL_CACHE_DEFAULT_MEMORY_ITEMS;
+
+static GHashTable* diskEntries = NULL; // key -> disk_entry_t
+static gint64 diskBytes = 0;
+static gint64 diskCapacity = THUMBNAIL_CACHE_DEFAULT_DISK_BYTES;
+
+static void free_disk_entry(disk_entry_t* entry) {
+  g_free(entry->key);
+  g_free(entry);
+}
+
+static void free_memory_entry(memory_entry_t* entry) {
+  memory_budget_release(MEMORY_POOL_THUMBNAILS, memory_get_pixbuf_bytes(entry->pixbuf));
+  g_free(entry->key);
+  g_object_unref(entry->pixbuf);
+  g_free(entry);
+}
+
+/* drops the least recently used thumbnails, tiles in the grid keep their own reference */
+static void evict_memory_entries(gint64 bytes, gpointer data) {
+  g_mutex_lock(&cacheMutex);
+  gint64 freed = 0;
+  while (freed < bytes && memoryOrder.length > 0) {
+    memory_entry_t* oldest = g_queue_pop_tail(&memoryOrder);
+    freed += memory_get_pixbuf_bytes(oldest->pixbuf);
+    g_hash_table_remove(memoryEntries, oldest->key);
+    free_memory_entry(oldest);
+  }
+  g_mutex_unlock(&cacheMutex);
+}
+
+static char* get_entry_path(char* key) {
+  gchar* name = g_strconcat(key, ".png", NULL);
+  char* path = g_build_filename(cacheDirectory, name, NULL);
+  g_free(name);
+  return path;
+}
+
+/* scans the cache directory once, file mtimes serve as last-use stamps */
+static void load_disk_index() {
+  GDir* dir = g_dir_open(cacheDirectory, 0, NULL);
+  const gchar* filename;
+  if (NULL == dir) {
+    return;
+  }
+  while ((filename = g_dir_read_name(dir))) {
+    if (!g_str_has_suffix(filename, ".png")) {
+      continue;
+    }
+    gchar* path = g_build_filename(cacheDirectory, filename, NULL);
+    GStatBuf st;
+    if (g_stat(path, &st) == 0) {
+      disk_entry_t* entry = (disk_entry_t*)g_malloc(sizeof(disk_entry_t));
+      entry->key = g_strndup(filename, strlen(filename) - strlen(".png"));
+      entry->size = st.st_size;
+      entry->lastUsed = st.st_mtime;
+      g_hash_table_insert(diskEntries, entry->key, entry);
+      diskBytes += entry->size;
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+}
+
+void thumbnail_cache_init(char* directory, gint64 maxDiskBytes, guint maxMemoryItems) {
+  g_mutex_lock(&cacheMutex);
+  if (NULL == memoryEntries) {
+    cacheDirectory = directory ? g_strdup(directory) : g_build_filename(g_get_user_cache_dir(), "picture-box", "thumbnails", NULL);
+    if (maxDiskBytes > 0) diskCapacity = maxDiskBytes;
+    if (maxMemoryItems > 0) memoryCapacity = maxMemoryItems;
+    g_mkdir_with_parents(cacheDirectory, 0700);
+    memoryEntries = g_hash_table_new(g_str_hash, g_str_equal);
+    diskEntries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_disk_entry);
+    load_disk_index();
+    memory_budget_set_evictor(MEMORY_POOL_THUMBNAILS, evict_memory_entries, NULL);
+  }
+  g_mutex_unlock(&cacheMutex);
+}
+
+/* content key: changes whenever the source file is replaced or modified */
+static char* make_cache_key(char* filename, gint64 size, gint64 mtime) {
+  gchar* identity = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT, filename, size, mtime);
+  char* key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, identity, -1);
+  g_free(identity);
+  return key;
+}
+
+static char* get_cache_key(char* filename) {
+  GStatBuf st;
+  if (g_stat(filename, &st) != 0) {
+    return NULL;
+  }
+  return make_cache_key(filename, (gint64)st.st_size, (gint64)st.st_mtime);
+}
+
+/* called with cacheMutex held */
+static GdkPixbuf* get_memory_entry(char* key) {
+  GList* link = g_hash_table_lookup(memoryEntries, key);
+  if (NULL == link) {
+    return NULL;
+  }
+  g_queue_unlink(&memoryOrder, link);
+  g_queue_push_head_link(&memoryOrder, link);
+  return g_object_ref(((memory_entry_t*)link->data)->pixbuf);
+}
+
+/* called with cacheMutex held */
+static void put_memory_entry(char* key, GdkPixbuf* pixbuf) {
+  if (g_hash_table_contains(memoryEntries, key)) {
+    return;
+  }
+  memory_entry_t* entry = (memory_entry_t*)g_malloc(sizeof(memory_entry_t));
+  entry->key = g_strdup(key);
+  entry->pixbuf = g_object_ref(pixbuf);
+  memory_budget_charge(MEMORY_POOL_THUMBNAILS, memory_get_pixbuf_bytes(pixbuf));
+  g_queue_push_head(&memoryOrder, entry);
+  g_hash_table_insert(memoryEntries, entry->key, memoryOrder.head);
+
+  while (memoryOrder.length > memoryCapacity) {
+    memory_entry_t* oldest = g_queue_pop_tail(&memoryOrder);
+    g_hash_table_remove(memoryEntries, oldest->key);
+    free_memory_entry(oldest);
+  }
+}
+
+/* called with cacheMutex held */
+static void evict_disk_entries() {
+  while (diskBytes > diskCapacity && g_hash_table_size(diskEntries) > 0) {
+    GHashTableIter iter;
+    disk_entry_t* entry;
+    disk_entry_t* oldest = NULL;
+    g_hash_table_iter_init(&iter, diskEntries);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+      if (NULL == oldest || entry->lastUsed < oldest->lastUsed) {
+        oldest = entry;
+      }
+    }
+    char* path = get_entry_path(oldest->key);
+    g_unlink(path);
+    g_free(path);
+    diskBytes -= oldest->size;
+    g_hash_table_remove(diskEntries, oldest->key);
+  }
+}
+
+/* for the main thread: size and mtime come from the caller, e.g. a directory listing, the file is not touched */
+GdkPixbuf* thumbnail_cache_lookup_memory(char* filename, gint64 size, gint64 mtime) {
+  if (NULL == memoryEntries) {
+    return NULL;
+  }
+  char* key = make_cache_key(filename, size, mtime);
+  g_mutex_lock(&cacheMutex);
+  GdkPixbuf* result = get_memory_entry(key);
+  g_mutex_unlock(&cacheMutex);
+  g_free(key);
+  return result;
+}
+
+GdkPixbuf* thumbnail_cache_lookup(char* filename) {
+  thumbnail_cache_init(NULL, 0, 0);
+  char* key = get_cache_key(filename);
+  if (NULL == key) {
+    return NULL;
+  }
+  g_mutex_lock(&cacheMutex);
+  GdkPixbuf* result = get_memory_entry(key);
+  disk_entry_t* entry = result ? NULL : g_hash_table_lookup(diskEntries, key);
+  if (entry) {
+    entry->lastUsed = g_get_real_time() / G_USEC_PER_SEC;
+  }
+  g_mutex_unlock(&cacheMutex);
+
+  if (entry) {
+    char* path = get_entry_path(key);
+    result = gdk_pixbuf_new_from_file(path, NULL);
+    if (result) {
+      utime(path, NULL); // keep the LRU order across restarts
+      g_mutex_lock(&cacheMutex);
+      put_memory_entry(key, result);
+      g_mutex_unlock(&cacheMutex);
+    }
+    g_free(path);
+  }
+  g_free(key);
+  TRACE_COUNT(result ? "thumbnail cache hit" : "thumbnail cache miss", 1);
+  return result;
+}
+
+void thumbnail_cache_store(char* filename, GdkPixbuf* pixbuf) {
+  thumbnail_cache_init(NULL, 0, 0);
+  char* key = get_cache_key(filename);
+  if (NULL == key || NULL == pixbuf) {
+    g_free(key);
+    return;
+  }
+  g_mutex_lock(&cacheMutex);
+  put_memory_entry(key, pixbuf);
+  gboolean onDisk = g_hash_table_contains(diskEntries, key);
+  g_mutex_unlock(&cacheMutex);
+
+  if (!onDisk) {
+    char* path = get_entry_path(key);
+    gchar* tempPath = g_strconcat(path, ".tmp", NULL);
+    GStatBuf st;
+    if (gdk_pixbuf_save(pixbuf, tempPath, "png", NULL, NULL) && g_rename(tempPath, path) == 0 && g_stat(path, &st) == 0) {
+      disk_entry_t* entry = (disk_entry_t*)g_malloc(sizeof(disk_entry_t));
+      entry->key = g_strdup(key);
+      entry->size = st.st_size;
+      entry->lastUsed = st.st_mtime;
+      g_mutex_lock(&cacheMutex);
+      if (!g_hash_table_contains(diskEntries, key)) {
+        g_hash_table_insert(diskEntries, entry->key, entry);
+        diskBytes += entry->size;
+        evict_disk_entries();
+      } else {
+        free_disk_entry(entry);
+      }
+      g_mutex_unlock(&cacheMutex);
+    } else {
+      g_unlink(tempPath);
+    }
+    g_free(tempPath);
+    g_free(path);
+  }
+  g_free(key);
+}
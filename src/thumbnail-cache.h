@@ -0,0 +1,7 @@
+#include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+void thumbnail_cache_init(char* directory, gint64 maxDiskBytes, guint maxMemoryItems);
+GdkPixbuf* thumbnail_cache_lookup_memory(char* filename, gint64 size, gint64 mtime);
+GdkPixbuf* thumbnail_cache_lookup(char* filename);
+void thumbnail_cache_store(char* filename, GdkPixbuf* pixbuf);
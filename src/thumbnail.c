@@ -0,0 +1,189 @@
+#include "thumbnail.h"
+#include "thumbnail-cache.h"
+#include "exif.h"
+#include "loader.h"
+#include "pdf.h"
+#include "trace.h"
+
+typedef struct {
+  char* filename;
+  thumbnail_kind_t kind;
+  int index; // position in the grid, used for visible-first ordering
+  guint generation;
+  thumbnail_callback_t callback;
+  gpointer user_data;
+  GdkPixbuf* result;
+} thumbnail_job_t;
+
+static GMutex jobMutex;
+static GCond jobCond;
+static GPtrArray* pendingJobs = NULL;
+static int activeJobs = 0;
+
+static guint currentGeneration = 0; // bumped on every cancel, stale results are dropped
+static int visibleFirst = 0;
+static int visibleLast = -1;
+
+static void free_job(thumbnail_job_t* job) {
+  g_free(job->filename);
+  if (job->result) {
+    g_object_unref(job->result);
+  }
+  g_free(job);
+}
+
+GdkPixbuf* create_thumbnail_pixbuf(char* filename, thumbnail_kind_t kind) {
+  TRACE_SCOPE("create_thumbnail_pixbuf");
+  GdkPixbuf* pixbuf = NULL;
+  cairo_surface_t* surface = NULL;
+  if (kind == THUMBNAIL_PDF) {
+    surface = get_pdf_thumbnail_cairo_surface(filename, 128, 128);
+  } else {
+    // camera JPEGs carry a small preview, decoding the full image is the fallback
+    pixbuf = load_exif_thumbnail(filename, THUMBNAIL_SIZE / 2);
+    if (NULL == pixbuf) {
+      surface = load_surface_covering(filename, THUMBNAIL_SIZE, THUMBNAIL_SIZE, NULL);
+    }
+  }
+  if (surface) {
+    pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface));
+    cairo_surface_destroy(surface);
+  }
+  if (NULL == pixbuf) {
+    return NULL;
+  }
+  GdkPixbuf* result = gdk_pixbuf_scale_simple(pixbuf, THUMBNAIL_SIZE, THUMBNAIL_SIZE, GDK_INTERP_BILINEAR);
+  g_object_unref(pixbuf);
+  return result;
+}
+
+static int job_distance(thumbnail_job_t* job) {
+  if (job->index < visibleFirst) {
+    return visibleFirst - job->index;
+  }
+  if (job->index > visibleLast) {
+    return job->index - visibleLast;
+  }
+  return 0;
+}
+
+/* picks the pending job closest to the visible range, called with jobMutex held */
+static thumbnail_job_t* take_next_job() {
+  guint best = 0;
+  int bestDistance = G_MAXINT;
+  for (guint i = 0; i < pendingJobs->len; i++) {
+    int distance = job_distance(g_ptr_array_index(pendingJobs, i));
+    if (distance < bestDistance) {
+      best = i;
+      bestDistance = distance;
+      if (distance == 0) break;
+    }
+  }
+  return g_ptr_array_remove_index(pendingJobs, best);
+}
+
+static gboolean deliver_job(gpointer data) {
+  thumbnail_job_t* job = (thumbnail_job_t*)data;
+  if (job->generation == currentGeneration) {
+    job->callback(job->result, job->index, job->user_data);
+  }
+  free_job(job);
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer thumbnail_worker(gpointer data) {
+  for (;;) {
+    g_mutex_lock(&jobMutex);
+    while (pendingJobs->len == 0) {
+      g_cond_wait(&jobCond, &jobMutex);
+    }
+    thumbnail_job_t* job = take_next_job();
+    gboolean stale = job->generation != currentGeneration;
+    activeJobs += stale ? 0 : 1;
+    g_mutex_unlock(&jobMutex);
+
+    if (stale) {
+      free_job(job);
+      continue;
+    }
+    job->result = thumbnail_cache_lookup(job->filename);
+    if (NULL == job->result) {
+      job->result = create_thumbnail_pixbuf(job->filename, job->kind);
+      thumbnail_cache_store(job->filename, job->result);
+    }
+    g_mutex_lock(&jobMutex);
+    activeJobs--;
+    g_mutex_unlock(&jobMutex);
+    g_idle_add(deliver_job, job);
+  }
+  return NULL;
+}
+
+void thumbnail_init() {
+  if (pendingJobs) {
+    return;
+  }
+  thumbnail_cache_init(NULL, 0, 0);
+  pendingJobs = g_ptr_array_new();
+  int threads = MAX(1, (int)g_get_num_processors() - 1);
+  for (int i = 0; i < threads; i++) {
+    g_thread_unref(g_thread_new("thumbnail", thumbnail_worker, NULL));
+  }
+}
+
+/*
+ * Queues a thumbnail, callback runs on the main loop unless cancelled before
+ * (immediately on a memory cache hit). size and mtime are those the directory
+ * listing reported, the file is only looked at on the worker.
+ */
+void thumbnail_request(char* filename, gint64 size, gint64 mtime, thumbnail_kind_t kind, int index, thumbnail_callback_t callback, gpointer user_data) {
+  thumbnail_init();
+  GdkPixbuf* cached = thumbnail_cache_lookup_memory(filename, size, mtime);
+  if (cached) {
+    callback(cached, index, user_data);
+    g_object_unref(cached);
+    return;
+  }
+  thumbnail_job_t* job = (thumbnail_job_t*)g_malloc0(sizeof(thumbnail_job_t));
+  job->filename = g_strdup(filename);
+  job->kind = kind;
+  job->index = index;
+  job->callback = callback;
+  job->user_data = user_data;
+
+  g_mutex_lock(&jobMutex);
+  job->generation = currentGeneration;
+  g_ptr_array_add(pendingJobs, job);
+  g_cond_signal(&jobCond);
+  g_mutex_unlock(&jobMutex);
+}
+
+void thumbnail_set_visible_range(int first, int last) {
+  g_mutex_lock(&jobMutex);
+  visibleFirst = first;
+  visibleLast = last;
+  g_mutex_unlock(&jobMutex);
+}
+
+void thumbnail_cancel_all() {
+  if (NULL == pendingJobs) {
+    return;
+  }
+  g_mutex_lock(&jobMutex);
+  currentGeneration++;
+  while (pendingJobs->len > 0) {
+    free_job(g_ptr_array_remove_index_fast(pendingJobs, pendingJobs->len - 1));
+  }
+  g_mutex_unlock(&jobMutex);
+}
+
+/* TRUE while thumbnails the user is waiting for are queued or being made */
+gboolean thumbnail_is_busy() {
+  if (NULL == pendingJobs) {
+    return FALSE;
+  }
+  g_mutex_lock(&jobMutex);
+  gboolean busy = pendingJobs->len > 0 || activeJobs > 0;
+  g_mutex_unlock(&jobMutex);
+  return busy;
+}
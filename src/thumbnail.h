@@ -0,0 +1,23 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <gtk/gtk.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#define THUMBNAIL_SIZE 122
+
+typedef enum {
+  THUMBNAIL_IMAGE,
+  THUMBNAIL_PDF
+} thumbnail_kind_t;
+
+typedef void(*thumbnail_callback_t)(GdkPixbuf* pixbuf, int index, gpointer user_data);
+
+void thumbnail_init();
+void thumbnail_request(char* filename, gint64 size, gint64 mtime, thumbnail_kind_t kind, int index, thumbnail_callback_t callback, gpointer user_data);
+void thumbnail_set_visible_range(int first, int last);
+void thumbnail_cancel_all();
+gboolean thumbnail_is_busy();
+GdkPixbuf* create_thumbnail_pixbuf(char* filename, thumbnail_kind_t kind);
+
+#endif
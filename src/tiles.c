@@ -0,0 +1,288 @@
+#include <math.h>
+
+#include "tiles.h"
+#include "memory-budget.h"
+
+#define TILE_PREVIEW_MAX_SIZE 1024.0
+#define TILE_PREVIEW_PRIORITY -1
+
+struct tile_view {
+  gint refCount; // held by the owner, queued jobs and pending notifications
+  gboolean closed;
+  tile_render_func_t render;
+  gpointer source;
+  GDestroyNotify destroy;
+  double width; // source units
+  double height;
+  guint maxTiles;
+  GThreadPool* pool; // a single thread, so the source is never used concurrently
+  GMutex mutex;
+  GHashTable* tiles; // key -> cairo_surface_t
+  GQueue order; // keys, most recently used first
+  GHashTable* pending; // keys of queued tiles
+  int scaleKey; // tiles for other scales are no longer rendered
+  cairo_surface_t* preview; // whole source at low resolution, drawn until tiles arrive
+  double previewScale;
+  gboolean previewPending;
+  void(*on_refined)(gpointer);
+  gpointer refinedData;
+};
+
+typedef struct {
+  tile_view_t* view;
+  char* key; // NULL for the preview pass
+  double scale;
+  int scaleKey;
+  int col;
+  int row;
+  int priority;
+} tile_job_t;
+
+static GMutex viewsMutex;
+static GList* views = NULL; // open views, for eviction
+
+static int get_scale_key(double scale) {
+  return (int)(scale * 1000 + 0.5);
+}
+
+static char* get_tile_key(int scaleKey, int col, int row) {
+  return g_strdup_printf("%i:%i:%i", scaleKey, col, row);
+}
+
+/* value destroy function of the tile table */
+static void release_tile(cairo_surface_t* tile) {
+  memory_budget_release(MEMORY_POOL_TILES, memory_get_surface_bytes(tile));
+  cairo_surface_destroy(tile);
+}
+
+static void unref_view(tile_view_t* view) {
+  if (!g_atomic_int_dec_and_test(&view->refCount)) {
+    return;
+  }
+  g_mutex_lock(&viewsMutex);
+  views = g_list_remove(views, view);
+  g_mutex_unlock(&viewsMutex);
+  if (view->destroy) {
+    view->destroy(view->source);
+  }
+  if (view->preview) {
+    release_tile(view->preview);
+  }
+  g_hash_table_destroy(view->tiles);
+  g_hash_table_destroy(view->pending);
+  g_queue_clear_full(&view->order, g_free);
+  g_mutex_clear(&view->mutex);
+  g_free(view);
+}
+
+static gboolean notify_refined(gpointer data) {
+  tile_view_t* view = (tile_view_t*)data;
+  if (!g_atomic_int_get(&view->closed) && view->on_refined) {
+    view->on_refined(view->refinedData);
+  }
+  unref_view(view);
+  return G_SOURCE_REMOVE;
+}
+
+static cairo_surface_t* render_surface(tile_view_t* view, int width, int height, double scale, double x, double y) {
+  cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  cairo_t* cr = cairo_create(surface);
+  cairo_set_source_rgb(cr, 1, 1, 1);
+  cairo_paint(cr);
+  cairo_rectangle(cr, 0, 0, width, height);
+  cairo_clip(cr);
+  cairo_translate(cr, -x, -y);
+  view->render(view->source, cr, scale);
+  cairo_destroy(cr);
+  return surface;
+}
+
+/* called with view->mutex held */
+static void put_tile(tile_view_t* view, char* key, cairo_surface_t* surface) {
+  memory_budget_charge(MEMORY_POOL_TILES, memory_get_surface_bytes(surface));
+  g_hash_table_insert(view->tiles, g_strdup(key), surface);
+  g_queue_push_head(&view->order, g_strdup(key));
+  while (view->order.length > view->maxTiles) {
+    char* oldest = g_queue_pop_tail(&view->order);
+    g_hash_table_remove(view->tiles, oldest);
+    g_free(oldest);
+  }
+}
+
+static void render_job(gpointer data, gpointer user_data) {
+  tile_job_t* job = (tile_job_t*)data;
+  tile_view_t* view = job->view;
+  gboolean rendered = FALSE;
+
+  if (!g_atomic_int_get(&view->closed)) {
+    if (NULL == job->key) {
+      int width = MAX(1, (int)ceil(view->width * view->previewScale));
+      int height = MAX(1, (int)ceil(view->height * view->previewScale));
+      cairo_surface_t* preview = render_surface(view, width, height, view->previewScale, 0, 0);
+      memory_budget_charge(MEMORY_POOL_TILES, memory_get_surface_bytes(preview));
+      g_mutex_lock(&view->mutex);
+      view->preview = preview;
+      g_mutex_unlock(&view->mutex);
+      rendered = TRUE;
+    } else if (job->scaleKey == g_atomic_int_get(&view->scaleKey)) {
+      cairo_surface_t* tile = render_surface(view, TILE_SIZE, TILE_SIZE, job->scale, job->col * TILE_SIZE, job->row * TILE_SIZE);
+      g_mutex_lock(&view->mutex);
+      put_tile(view, job->key, tile);
+      g_mutex_unlock(&view->mutex);
+      rendered = TRUE;
+    }
+  }
+  if (job->key) {
+    g_mutex_lock(&view->mutex);
+    g_hash_table_remove(view->pending, job->key);
+    g_mutex_unlock(&view->mutex);
+  }
+  if (rendered) {
+    g_atomic_int_inc(&view->refCount);
+    g_idle_add(notify_refined, view);
+  }
+  g_free(job->key);
+  g_free(job);
+  unref_view(view);
+}
+
+static gint compare_jobs(gconstpointer a, gconstpointer b, gpointer data) {
+  return ((tile_job_t*)a)->priority - ((tile_job_t*)b)->priority;
+}
+
+static void queue_job(tile_view_t* view, char* key, double scale, int col, int row, int priority) {
+  tile_job_t* job = (tile_job_t*)g_malloc0(sizeof(tile_job_t));
+  job->view = view;
+  job->key = g_strdup(key);
+  job->scale = scale;
+  job->scaleKey = get_scale_key(scale);
+  job->col = col;
+  job->row = row;
+  job->priority = priority;
+  g_atomic_int_inc(&view->refCount);
+  g_thread_pool_push(view->pool, job, NULL);
+}
+
+/* drops the least recently drawn tiles of all views, the low resolution pass stays */
+static void evict_tiles(gint64 bytes, gpointer data) {
+  gint64 freed = 0;
+  g_mutex_lock(&viewsMutex);
+  for (GList* iter = views; iter != NULL && freed < bytes; iter = g_list_next(iter)) {
+    tile_view_t* view = (tile_view_t*)iter->data;
+    g_mutex_lock(&view->mutex);
+    while (freed < bytes && view->order.length > 0) {
+      char* oldest = g_queue_pop_tail(&view->order);
+      freed += memory_get_surface_bytes(g_hash_table_lookup(view->tiles, oldest));
+      g_hash_table_remove(view->tiles, oldest);
+      g_free(oldest);
+    }
+    g_mutex_unlock(&view->mutex);
+  }
+  g_mutex_unlock(&viewsMutex);
+}
+
+/*
+ * Creates a tiled view of a source of width x height units. At most maxTiles
+ * tiles are kept, so memory does not depend on the source size or zoom.
+ */
+tile_view_t* tile_view_new(tile_render_func_t render, gpointer source, GDestroyNotify destroy, double width, double height, guint maxTiles) {
+  tile_view_t* view = (tile_view_t*)g_malloc0(sizeof(tile_view_t));
+  view->refCount = 1;
+  view->render = render;
+  view->source = source;
+  view->destroy = destroy;
+  view->width = width;
+  view->height = height;
+  view->maxTiles = MAX(1, maxTiles);
+  view->scaleKey = -1;
+  view->previewScale = MIN(1.0, TILE_PREVIEW_MAX_SIZE / MAX(width, height));
+  g_mutex_init(&view->mutex);
+  g_queue_init(&view->order);
+  view->tiles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)release_tile);
+  view->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  view->pool = g_thread_pool_new(render_job, NULL, 1, FALSE, NULL);
+  g_thread_pool_set_sort_function(view->pool, compare_jobs, NULL);
+  g_mutex_lock(&viewsMutex);
+  views = g_list_prepend(views, view);
+  g_mutex_unlock(&viewsMutex);
+  memory_budget_set_evictor(MEMORY_POOL_TILES, evict_tiles, NULL);
+  return view;
+}
+
+void tile_view_free(tile_view_t* view) {
+  g_atomic_int_set(&view->closed, TRUE);
+  // queued jobs see the closed flag and only drop their reference
+  g_thread_pool_free(view->pool, FALSE, FALSE);
+  unref_view(view);
+}
+
+/* called on the main loop whenever a better version of some area is available */
+void tile_view_set_refined_callback(tile_view_t* view, void(*callback)(gpointer), gpointer data) {
+  view->on_refined = callback;
+  view->refinedData = data;
+}
+
+void tile_view_get_size(tile_view_t* view, double* width, double* height) {
+  *width = view->width;
+  *height = view->height;
+}
+
+/*
+ * Draws the source scaled by scale with its origin at x, y. Visible tiles that
+ * are not rendered yet are queued and filled from the low resolution pass.
+ */
+void tile_view_draw(tile_view_t* view, cairo_t* cr, double scale, double x, double y, int viewWidth, int viewHeight) {
+  int scaleKey = get_scale_key(scale);
+  double width = view->width * scale;
+  double height = view->height * scale;
+  int cols = (int)ceil(width / TILE_SIZE);
+  int rows = (int)ceil(height / TILE_SIZE);
+  int firstCol = MAX(0, (int)floor(-x / TILE_SIZE));
+  int lastCol = MIN(cols - 1, (int)floor((viewWidth - x) / TILE_SIZE));
+  int firstRow = MAX(0, (int)floor(-y / TILE_SIZE));
+  int lastRow = MIN(rows - 1, (int)floor((viewHeight - y) / TILE_SIZE));
+
+  g_atomic_int_set(&view->scaleKey, scaleKey);
+
+  g_mutex_lock(&view->mutex);
+  if (NULL == view->preview && !view->previewPending) {
+    view->previewPending = TRUE;
+    queue_job(view, NULL, view->previewScale, 0, 0, TILE_PREVIEW_PRIORITY);
+  }
+  for (int row = firstRow; row <= lastRow; row++) {
+    for (int col = firstCol; col <= lastCol; col++) {
+      char* key = get_tile_key(scaleKey, col, row);
+      double tileX = x + col * TILE_SIZE;
+      double tileY = y + row * TILE_SIZE;
+      cairo_save(cr);
+      cairo_rectangle(cr, tileX, tileY, MIN(TILE_SIZE, width - col * TILE_SIZE), MIN(TILE_SIZE, height - row * TILE_SIZE));
+      cairo_clip(cr);
+      cairo_surface_t* tile = g_hash_table_lookup(view->tiles, key);
+      if (tile) {
+        GList* link = g_queue_find_custom(&view->order, key, (GCompareFunc)g_strcmp0);
+        g_queue_unlink(&view->order, link);
+        g_queue_push_head_link(&view->order, link);
+        cairo_set_source_surface(cr, tile, tileX, tileY);
+        cairo_paint(cr);
+      } else {
+        if (view->preview) {
+          cairo_translate(cr, x, y);
+          cairo_scale(cr, scale / view->previewScale, scale / view->previewScale);
+          cairo_set_source_surface(cr, view->preview, 0, 0);
+          cairo_paint(cr);
+        } else {
+          cairo_set_source_rgb(cr, 1, 1, 1);
+          cairo_paint(cr);
+        }
+        if (!g_hash_table_contains(view->pending, key)) {
+          g_hash_table_add(view->pending, g_strdup(key));
+          // tiles nearer the top left of the viewport come first
+          queue_job(view, key, scale, col, row, (row - firstRow) + (col - firstCol));
+        }
+      }
+      cairo_restore(cr);
+      g_free(key);
+    }
+  }
+  g_mutex_unlock(&view->mutex);
+}
@@ -0,0 +1,19 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <gtk/gtk.h>
+
+#define TILE_SIZE 256
+
+/* renders the whole source at scale into cr, which is already positioned and clipped to one tile */
+typedef void(*tile_render_func_t)(gpointer source, cairo_t* cr, double scale);
+
+typedef struct tile_view tile_view_t;
+
+tile_view_t* tile_view_new(tile_render_func_t render, gpointer source, GDestroyNotify destroy, double width, double height, guint maxTiles);
+void tile_view_free(tile_view_t* view);
+void tile_view_set_refined_callback(tile_view_t* view, void(*callback)(gpointer), gpointer data);
+void tile_view_get_size(tile_view_t* view, double* width, double* height);
+void tile_view_draw(tile_view_t* view, cairo_t* cr, double scale, double x, double y, int viewWidth, int viewHeight);
+
+#endif
@@ -0,0 +1,219 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+
+#include "trace.h"
+
+#define TRACE_MAX_EVENTS (1024 * 1024) // the oldest events are dropped beyond this
+#define TRACE_FLUSH_SECONDS 60 // terminals are mostly switched off, not closed, the file is rewritten this often
+
+typedef struct {
+  const char* name;
+  gint64 start; // microseconds since trace_init
+  gint64 duration; // timers
+  gint64 value; // counters
+  int thread;
+  gboolean counter;
+} trace_event_t;
+
+typedef struct {
+  gboolean counter;
+  gint64 count;
+  gint64 total; // microseconds for timers, the sum for counters
+  gint64 max;
+} trace_stat_t;
+
+gboolean traceEnabled = FALSE;
+
+static GMutex traceMutex;
+static trace_event_t* events = NULL; // ring buffer, only kept when a trace file is written
+static guint eventCount = 0;
+static guint eventNext = 0;
+static GHashTable* stats = NULL; // name -> trace_stat_t since the last stats log
+static char* traceFile = NULL;
+static gint64 traceStart = 0;
+
+static GMutex writeMutex; // one writer of the trace file at a time
+static gint flushing = 0;
+
+static GPrivate threadId;
+static gint nextThreadId = 0;
+
+static int get_thread_id() {
+  int id = GPOINTER_TO_INT(g_private_get(&threadId));
+  if (id == 0) {
+    id = g_atomic_int_add(&nextThreadId, 1) + 1;
+    g_private_set(&threadId, GINT_TO_POINTER(id));
+  }
+  return id;
+}
+
+static void add_event(trace_event_t* event) {
+  g_mutex_lock(&traceMutex);
+  if (events) {
+    events[eventNext] = *event;
+    eventNext = (eventNext + 1) % TRACE_MAX_EVENTS;
+    eventCount = MIN(eventCount + 1, TRACE_MAX_EVENTS);
+  }
+  trace_stat_t* stat = g_hash_table_lookup(stats, event->name);
+  if (NULL == stat) {
+    stat = g_new0(trace_stat_t, 1);
+    stat->counter = event->counter;
+    g_hash_table_insert(stats, (gpointer)event->name, stat);
+  }
+  gint64 value = event->counter ? event->value : event->duration;
+  stat->count++;
+  stat->total += value;
+  stat->max = MAX(stat->max, value);
+  g_mutex_unlock(&traceMutex);
+}
+
+static void print_stat(gpointer key, gpointer value, gpointer data) {
+  trace_stat_t* stat = (trace_stat_t*)value;
+  if (stat->counter) {
+    g_print("  %-36s %8" G_GINT64_FORMAT " x, sum %" G_GINT64_FORMAT "\n", (char*)key, stat->count, stat->total);
+  } else {
+    g_print("  %-36s %8" G_GINT64_FORMAT " x, %9.2f ms total, %7.2f ms avg, %7.2f ms max\n", (char*)key, stat->count,
+            stat->total / 1000.0, stat->total / 1000.0 / stat->count, stat->max / 1000.0);
+  }
+}
+
+static gboolean log_stats(gpointer data) {
+  g_mutex_lock(&traceMutex);
+  if (g_hash_table_size(stats) > 0) {
+    g_print("Stats:\n");
+    g_hash_table_foreach(stats, print_stat, NULL);
+    g_hash_table_remove_all(stats);
+  }
+  g_mutex_unlock(&traceMutex);
+  return G_SOURCE_CONTINUE;
+}
+
+static void write_trace_file() {
+  GError* error = NULL;
+  if (!trace_write_json(traceFile, &error)) {
+    g_print("Trace: %s\n", error->message);
+    g_error_free(error);
+  }
+}
+
+static gpointer run_flush(gpointer data) {
+  write_trace_file();
+  g_atomic_int_set(&flushing, 0);
+  return NULL;
+}
+
+/* writes the trace on a thread of its own, the UI keeps running meanwhile */
+static gboolean flush_trace(gpointer data) {
+  if (g_atomic_int_compare_and_exchange(&flushing, 0, 1)) {
+    g_thread_unref(g_thread_new("trace", run_flush, NULL));
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_terminate(gpointer data) {
+  int signum = GPOINTER_TO_INT(data);
+  trace_shutdown();
+  signal(signum, SIG_DFL);
+  raise(signum);
+  return G_SOURCE_REMOVE;
+}
+
+/* enables tracing from PICTURE_BOX_TRACE and PICTURE_BOX_STATS, call before any other thread starts */
+void trace_init() {
+  const char* file = g_getenv("PICTURE_BOX_TRACE");
+  const char* interval = g_getenv("PICTURE_BOX_STATS");
+  if ((NULL == file || !*file) && (NULL == interval || atoi(interval) <= 0)) {
+    return;
+  }
+  traceStart = g_get_monotonic_time();
+  stats = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  if (file && *file) {
+    traceFile = g_strdup(file);
+    events = g_new(trace_event_t, TRACE_MAX_EVENTS);
+    g_timeout_add_seconds(TRACE_FLUSH_SECONDS, flush_trace, NULL);
+  }
+  if (interval && atoi(interval) > 0) {
+    g_timeout_add_seconds(atoi(interval), log_stats, NULL);
+  }
+  traceEnabled = TRUE;
+}
+
+/* writes the trace file, if any, and the remaining stats */
+void trace_shutdown() {
+  if (!traceEnabled) {
+    return;
+  }
+  if (traceFile) {
+    write_trace_file();
+  }
+  log_stats(NULL);
+}
+
+/* SIGTERM and SIGINT end the process after trace_shutdown, needs a running main loop */
+void trace_watch_signals() {
+  if (traceEnabled) {
+    g_unix_signal_add(SIGTERM, on_terminate, GINT_TO_POINTER(SIGTERM));
+    g_unix_signal_add(SIGINT, on_terminate, GINT_TO_POINTER(SIGINT));
+  }
+}
+
+void trace_scope_end(trace_scope_t* scope) {
+  if (NULL == scope->name) {
+    return;
+  }
+  gint64 now = g_get_monotonic_time();
+  trace_event_t event = { scope->name, scope->start - traceStart, now - scope->start, 0, get_thread_id(), FALSE };
+  add_event(&event);
+}
+
+void trace_count(const char* name, gint64 value) {
+  trace_event_t event = { name, g_get_monotonic_time() - traceStart, 0, value, get_thread_id(), TRUE };
+  add_event(&event);
+}
+
+/* Chrome trace event format: complete events for timers, counter events for counters */
+gboolean trace_write_json(char* filename, GError** error) {
+  // a snapshot, so the other threads are not held up while the file is written
+  g_mutex_lock(&traceMutex);
+  guint count = eventCount;
+  trace_event_t* snapshot = g_new(trace_event_t, MAX(1, count));
+  guint first = (eventNext + TRACE_MAX_EVENTS - eventCount) % TRACE_MAX_EVENTS;
+  for (guint i = 0; i < count; i++) {
+    snapshot[i] = events[(first + i) % TRACE_MAX_EVENTS];
+  }
+  g_mutex_unlock(&traceMutex);
+
+  // written next to the file and renamed, a power cut leaves the previous trace
+  g_mutex_lock(&writeMutex);
+  gchar* tempName = g_strconcat(filename, ".tmp", NULL);
+  FILE* file = g_fopen(tempName, "w");
+  gboolean ok = file != NULL;
+  if (file) {
+    fputs("{\"traceEvents\":[\n", file);
+    for (guint i = 0; i < count; i++) {
+      trace_event_t* event = &snapshot[i];
+      gchar* name = g_strescape(event->name, NULL);
+      if (event->counter) {
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%i,\"args\":{\"value\":%" G_GINT64_FORMAT "}}",
+                i ? ",\n" : "", name, event->start, event->thread, event->value);
+      } else {
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%i}",
+                i ? ",\n" : "", name, event->start, event->duration, event->thread);
+      }
+      g_free(name);
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+    ok = fclose(file) == 0 && g_rename(tempName, filename) == 0;
+  }
+  if (!ok) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED, "Cannot write %s", filename);
+    g_unlink(tempName);
+  }
+  g_free(tempName);
+  g_mutex_unlock(&writeMutex);
+  g_free(snapshot);
+  return ok;
+}
@@ -0,0 +1,34 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Scoped timers and counters. Disabled unless PICTURE_BOX_TRACE names a file
+ * for the Chrome trace (chrome://tracing, Perfetto) or PICTURE_BOX_STATS sets
+ * a stats interval in seconds; disabled, a scope costs one branch. The trace
+ * file is rewritten every minute and on SIGTERM/SIGINT, not only on exit.
+ */
+
+typedef struct {
+  const char* name; // NULL while tracing is disabled
+  gint64 start;
+} trace_scope_t;
+
+extern gboolean traceEnabled;
+
+void trace_init();
+void trace_shutdown();
+void trace_watch_signals();
+void trace_scope_end(trace_scope_t* scope);
+void trace_count(const char* name, gint64 value);
+gboolean trace_write_json(char* filename, GError** error);
+
+/* times the rest of the enclosing block, name must be a string literal */
+#define TRACE_SCOPE(name) \
+  trace_scope_t _traceScope __attribute__((cleanup(trace_scope_end))) = { traceEnabled ? (name) : NULL, traceEnabled ? g_get_monotonic_time() : 0 }
+
+#define TRACE_COUNT(name, value) \
+  do { if (traceEnabled) trace_count((name), (value)); } while (0)
+
+#endif